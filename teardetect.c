@@ -1,3 +1,6 @@
+#if defined(LINUX) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE	/* CPU_SET, pthread_setaffinity_np */
+#endif
 #include <glad/glad.h>
 #if defined(WIN32)
 #include <glad/glad_wgl.h>
@@ -10,6 +13,15 @@
 #endif
 #include <GLFW/glfw3.h>
 #include <GLFW/glfw3native.h>
+#if defined(LINUX)
+/* from glfw3native.h, which can't be used with GLFW_EXPOSE_NATIVE_GLX
+ * because its GL/glx.h conflicts with glad_glx.h */
+GLFWAPI GLXContext glfwGetGLXContext(GLFWwindow* window);
+#endif
+#if defined(LINUX) && defined(HAVE_XCB_PRESENT)
+#include <X11/Xlib-xcb.h>
+#include <xcb/present.h>
+#endif
 
 #include <stdarg.h>
 #include <stdio.h>
@@ -17,18 +29,47 @@
 #include <math.h>
 #include <time.h>
 #include <errno.h>
+#include <string.h>
+#include <limits.h>
+#include <sys/stat.h>
+#if defined(WIN32)
+#include <direct.h>
+#include <process.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#endif
 
 #define APPTITLE "GLTearDetect"
 
 /****************************************************************************
  * DATA STRUCTURES                                                          *
  ****************************************************************************/
+/* on-disk cache of linked program binaries */
+#define PROGRAM_CACHE_PATH_MAX	1024
+
+typedef struct {
+	char dir[PROGRAM_CACHE_PATH_MAX];	/* empty: disabled */
+	int supported;			/* -1: not known yet */
+	uint64_t driver;		/* hash of vendor, renderer and version */
+	unsigned int hits;
+	unsigned int misses;
+	unsigned int rejected;		/* unreadable or refused by the driver */
+	unsigned int stored;
+	unsigned int failed;
+	uint64_t time;			/* spent in make_program */
+} TDProgramCache;
+
 typedef struct {
 	GLFWwindow *win;
+	GLFWwindow *share;	/* hidden context owning the shared objects */
 	int pos[2];
 	int size[2];
 	int windowed_pos[2];
 	int windowed_size[2];
+	int refresh_rate;
+	int decorated;		/* as created, GLFW 3.2 can't change it later */
 	unsigned int flags;
 } TDWindow;
 
@@ -43,6 +84,9 @@ typedef enum {
 	TDDISP_COLORS,
 	TDDISP_PULSE,
 	TDDISP_BARS,
+	TDDISP_LOAD,
+	TDDISP_PIPELINE,
+	TDDISP_DRAWS,
 	TDDISP_MODE_COUNT
 } TDDisplayMode;
 
@@ -68,7 +112,685 @@ typedef struct {
 	GLfloat data[3];
 } TDBars;
 
+/* the bars, drawn with a tunable GPU load: ALU iterations per pixel, and
+ * a buffer texture that is streamed once per frame */
+#define GPU_LOAD_ITERATIONS_MAX	(1U<<20)
+#define GPU_LOAD_MEMORY_MAX	1024U
+
+typedef struct {
+	GLuint program;
+	GLuint vao;
+	GLuint buffer;
+	GLuint tex;
+	GLint loc_data;
+	GLint loc_load;
+	unsigned int iterations;	/* ALU loop iterations per pixel */
+	unsigned int memory;		/* MiB read per frame */
+	unsigned int allocated;		/* MiB in the buffer */
+} TDLoad;
+
+/* an engine like frame: G-buffer pass into multiple (multisampled) render
+ * targets, MSAA resolve, a composite pass, post processing passes and a
+ * final blit to the window, at an internal resolution */
+#define PIPELINE_TARGETS	3
+#define PIPELINE_PASSES_MAX	64
+#define PIPELINE_SCALE_MAX	400
+
+typedef struct {
+	GLuint prog_gbuffer;
+	GLuint prog_composite;
+	GLuint prog_post;
+	GLint loc_data;
+	GLint loc_scale;
+	GLuint vao;
+	GLuint fbo_ms;				/* multisampled G-buffer */
+	GLuint rb[PIPELINE_TARGETS];
+	GLuint fbo_gbuf;			/* resolved G-buffer */
+	GLuint tex_gbuf[PIPELINE_TARGETS];
+	GLuint fbo_post[2];			/* ping-pong post processing */
+	GLuint tex_post[2];
+	unsigned int passes;		/* post processing passes */
+	unsigned int samples;		/* MSAA samples, 0: off */
+	unsigned int scale;		/* internal resolution in percent */
+	GLsizei size[2];		/* allocated internal resolution */
+	unsigned int allocated_samples;
+	uint64_t bytes;			/* render target memory */
+	int valid;
+} TDPipeline;
+
+/* many tiny quads over the bars, to load the render thread with draw call
+ * and state change overhead in the driver */
+typedef enum {
+	TDDRAW_NAIVE=0,		/* a draw call per quad, switching state in between */
+	TDDRAW_INSTANCED,	/* one instanced draw per program */
+	TDDRAW_INDIRECT,	/* one glMultiDrawArraysIndirect per program */
+	TDDRAW_METHOD_COUNT
+} TDDrawMethod;
+
+#define DRAWS_MAX	1000000U
+#define DRAWS_VAOS	4
+#define DRAWS_PROGRAMS	2
+
+typedef struct {
+	GLuint program[DRAWS_PROGRAMS];
+	GLint loc_grid[DRAWS_PROGRAMS];
+	GLint loc_offset[DRAWS_PROGRAMS];
+	GLuint vao[DRAWS_VAOS];
+	GLuint index;			/* per instance quad index */
+	GLuint indirect;		/* draw commands */
+	unsigned int count;		/* draws per frame */
+	TDDrawMethod method;
+	unsigned int allocated;
+	int warned;
+} TDDraws;
+
+/* texture streaming: every frame, the configured amount of data is
+ * uploaded into a texture, which is then shown as thumbnail */
+typedef enum {
+	TDUPLOAD_TEXIMAGE=0,	/* glTexSubImage2D from client memory */
+	TDUPLOAD_ORPHAN,	/* one PBO, orphaned every frame */
+	TDUPLOAD_PBO,		/* round robin PBOs */
+	TDUPLOAD_PERSISTENT,	/* persistently mapped ring (ARB_buffer_storage) */
+	TDUPLOAD_METHOD_COUNT
+} TDUploadMethod;
+
+#define UPLOAD_WIDTH	4096
+#define UPLOAD_BUFFERS	3
+#define UPLOAD_MAX	256U
+
+typedef struct {
+	unsigned int size;		/* MiB per frame, 0: off */
+	TDUploadMethod method;
+	TDUploadMethod used;		/* after fallbacks */
+	TDUploadMethod allocated_method;
+	unsigned int allocated;		/* MiB of the current objects */
+	unsigned char *data;		/* source data in client memory */
+	GLuint tex;
+	GLuint fbo;			/* to blit the thumbnail */
+	GLuint pbo[UPLOAD_BUFFERS];
+	unsigned char *mapped;		/* persistent mapping of pbo[0] */
+	GLsync fence[UPLOAD_BUFFERS];
+	unsigned int frame;
+} TDUpload;
+
+/* GPU probes issued per frame, all are GL_TIMESTAMP queries except
+ * TDPROBE_DRAW_TIME, which is a GL_TIME_ELAPSED query around td_disp */
+typedef enum {
+	TDPROBE_FRAME_BEGIN=0,
+	TDPROBE_DRAW_END,
+	TDPROBE_SWAP_BEGIN,
+	TDPROBE_SWAP_END,
+	TDPROBE_UPLOAD_BEGIN,
+	TDPROBE_UPLOAD_END,
+	TDPROBE_DRAW_TIME,
+	TDPROBE_COUNT
+} TDProbe;
+
+/* how the window system completed a presentation */
+typedef enum {
+	TDCOMPLETE_UNKNOWN=0,
+	TDCOMPLETE_COPY,
+	TDCOMPLETE_FLIP,
+	TDCOMPLETE_SKIP,
+	TDCOMPLETE_SUBOPTIMAL_COPY,
+	TDCOMPLETE_COUNT
+} TDCompleteMode;
+
+/* per-frame telemetry, all CPU times are CLOCK_MONOTONIC nanoseconds,
+ * the GPU timestamps are in the GL_TIMESTAMP time domain, and gl_offset
+ * is the difference between both domains (GL minus CPU) */
+typedef struct {
+	unsigned int frame;
+	unsigned int flags;
+	unsigned int step;
+	uint64_t t_poll;
+	uint64_t t_draw;
+	uint64_t t_swap;
+	uint64_t t_swap_ret;
+	uint64_t gpu[TDPROBE_COUNT];
+	int64_t gl_offset;
+	int64_t latency;
+	uint64_t t_present;	/* 0 if unknown */
+	int64_t msc;
+	int64_t sbc;		/* 0 if no present timing backend is used */
+	TDCompleteMode complete;
+	uint64_t t_vblank;	/* last vblank before t_swap_ret, 0 if unknown */
+	unsigned int vblank_count;
+	uint64_t fence_wait;	/* time spent in the frames-in-flight limiter */
+	int64_t cap_error;	/* frame start minus its deadline */
+	uint64_t jit_target;	/* vblank targeted by the JIT controller */
+	uint64_t upload_cpu;	/* CPU time of the texture upload */
+} TDFrameRecord;
+
+/* frame record flags */
+#define TDFRAME_DROPPED		0x1
+#define TDFRAME_WARMUP		0x2
+#define TDFRAME_LIMITED		0x4	/* frames in flight were limited */
+#define TDFRAME_CAPPED		0x8	/* frame was started at a deadline */
+#define TDFRAME_JIT		0x10	/* frame was started just in time */
+#define TDFRAME_JIT_MISSED	0x20	/* ... but too late for its vblank */
+#define TDFRAME_CONTENDED	0x40	/* worker threads were running */
+#define TDFRAME_UPLOAD		0x80	/* texture data was uploaded */
+#define TDFRAME_SHARED		0x100	/* the shared context thread was running */
+#define TDFRAME_JIT_PENDING	0x200	/* JIT hit or miss waits for the present time */
+
 #define TIMER_QUERY_COUNT 10
+#define TIMER_QUERY_MAX 256
+
+typedef struct {
+	GLuint query[TDPROBE_COUNT];
+	GLuint64 timestamp;
+	TDFrameRecord rec;
+} TDQuerySlot;
+
+typedef struct {
+	TDQuerySlot *slot;
+	TDQuerySlot lost;
+	unsigned int size;
+	unsigned int head;
+	unsigned int count;
+	unsigned int dropped;
+} TDQueryRing;
+
+/* where the swap completion times come from */
+typedef enum {
+	TDPRESENT_AUTO=0,
+	TDPRESENT_QUERY,	/* timer queries only, no display timestamps */
+#if defined(LINUX)
+	TDPRESENT_OML,		/* poll GLX_OML_sync_control */
+	TDPRESENT_INTEL,	/* GLX_INTEL_swap_event */
+#if defined(HAVE_XCB_PRESENT)
+	TDPRESENT_XPRESENT,	/* X Present extension events */
+#endif
+#endif
+	TDPRESENT_COUNT
+} TDPresentMode;
+
+/* frames whose present time did not show up for this long are given up */
+#define PRESENT_TIMEOUT_FRAMES 16
+/* frames to wait for the first X Present event before falling back */
+#define PRESENT_PROBE_FRAMES 60
+
+typedef struct {
+	TDPresentMode requested;
+	TDPresentMode mode;
+	TDPresentMode used;	/* last mode selected, for the report */
+#if defined(LINUX)
+	Display *dpy;
+	GLXDrawable drawable;	/* GLFW renders into a GLXWindow of its own */
+	Window window;		/* the X window, for the Present requests */
+	int event_base;
+	int64_t sbc_offset;	/* server SBC minus our own swap count */
+#if defined(HAVE_XCB_PRESENT)
+	xcb_connection_t *conn;
+	xcb_special_event_t *special;
+	uint32_t eid;
+#endif
+#endif
+	int64_t sbc_issued;
+	int64_t sbc_done;
+	unsigned int presented;
+	unsigned int missed;
+} TDPresent;
+
+#if defined(WIN32)
+typedef HANDLE TDThread;
+typedef DWORD (WINAPI *TDThreadFunc)(LPVOID);
+#define TD_THREAD_FUNC(name, arg) static DWORD WINAPI name(LPVOID arg)
+#define TD_THREAD_RETURN return 0
+#else
+typedef pthread_t TDThread;
+typedef void *(*TDThreadFunc)(void *);
+#define TD_THREAD_FUNC(name, arg) static void *name(void *arg)
+#define TD_THREAD_RETURN return NULL
+#endif
+
+/* single producer, single consumer ring buffer of fixed size elements,
+ * head is only written by the producer, tail only by the consumer */
+typedef struct {
+	unsigned char *data;
+	size_t elem_size;
+	unsigned int mask;
+	unsigned int overflow;
+	unsigned int head;
+	char pad[60];
+	unsigned int tail;
+} TDSpscRing;
+
+#define TELEMETRY_RING_SIZE (1U<<16)
+
+typedef struct {
+	TDSpscRing ring;
+	const char *filename;
+	FILE *file;
+	TDThread thread;
+	unsigned int run;
+	unsigned int written;
+	int active;
+} TDTelemetry;
+
+/* background calibration of the GL_TIMESTAMP clock against CLOCK_MONOTONIC,
+ * the model is gl - gl_ref = (cpu - cpu_ref) * (1 + drift) + offset */
+#define CLOCK_CALIB_SAMPLES 32
+#define CLOCK_CALIB_INTERVAL_NS 250000000ULL
+#define CLOCK_CALIB_MIN_SAMPLES 4
+
+typedef struct {
+	uint64_t cpu;
+	uint64_t gl;
+	uint64_t width;
+} TDClockSample;
+
+typedef struct {
+	uint64_t cpu_ref;
+	uint64_t gl_ref;
+	double offset;
+	double drift;
+	double rms;
+	unsigned int samples;
+} TDClockModel;
+
+typedef struct {
+	int enabled;
+	int active;
+	GLFWwindow *win;
+	TDThread thread;
+	unsigned int run;
+	/* published model, protected by the sequence counter seq */
+	unsigned int seq;
+	TDClockModel model;
+	/* only used by the calibration thread */
+	TDClockSample sample[CLOCK_CALIB_SAMPLES];
+	unsigned int count;
+	unsigned int next;
+} TDClockCalib;
+
+/* online estimate of the real refresh period and vblank phase: a Kalman
+ * filter over the state (time of the last vblank, period), observed through
+ * the SwapBuffers return times */
+#define REFRESH_LOCK_UPDATES	60	/* updates before the estimate is trusted */
+#define REFRESH_MAX_OUTLIERS	30	/* consecutive outliers before restarting */
+#define REFRESH_MISMATCH	0.0005	/* relative mismatch against the video mode */
+
+typedef struct {
+	double nominal;		/* period from the video mode, 0 if unknown */
+	double phase;		/* time of the last vblank, relative to t_base */
+	double period;
+	double P[2][2];		/* state covariance */
+	double R;		/* measurement noise, adapted from the residuals */
+	double vblanks;		/* moving average of vblanks per frame */
+	uint64_t t_base;
+	unsigned int updates;
+	unsigned int outliers;
+	unsigned int outliers_seq;
+	int state;
+} TDRefreshEst;
+
+/* refresh estimator states */
+#define TDREFRESH_EMPTY		0
+#define TDREFRESH_FIRST		1
+#define TDREFRESH_TRACKING	2
+
+/* how to wait for a fence */
+typedef enum {
+	TDWAIT_BLOCK=0,		/* glClientWaitSync with a timeout */
+	TDWAIT_SPIN,		/* poll without a timeout */
+	TDWAIT_YIELD,		/* poll, yielding the CPU in between */
+	TDWAIT_COUNT
+} TDWaitStrategy;
+
+#define FRAMES_IN_FLIGHT_MAX 8
+
+/* bound the number of frames queued to the GPU with a fence per frame */
+typedef struct {
+	GLsync fence[FRAMES_IN_FLIGHT_MAX + 1];
+	unsigned int frame;
+	int warned;
+} TDFrameLimiter;
+
+/* frame rate cap: each frame is started at an absolute deadline, by
+ * sleeping until shortly before it and spinning for the rest; the spin
+ * margin adapts to the oversleep measured */
+#define FRAME_CAP_MARGIN_MIN	20000ULL
+#define FRAME_CAP_MARGIN_INIT	500000ULL
+
+typedef struct {
+	uint64_t deadline;	/* of the next frame, 0 if not started */
+	uint64_t margin;	/* time reserved for spinning */
+	uint64_t oversleep;	/* last measured */
+	unsigned int resets;	/* deadlines missed by more than a frame */
+} TDFrameCap;
+
+/* just in time rendering: start each frame as late as possible so that
+ * its swap is issued margin before the targeted vblank */
+#define JIT_MARGIN_DEFAULT	1000000ULL
+/* scenario "jit on": keep the configured margin */
+#define JIT_MARGIN_KEEP		UINT64_MAX
+
+typedef struct {
+	uint64_t margin_min;	/* configured safety margin */
+	uint64_t margin;	/* current margin, grows after misses */
+	double cost;		/* moving average of the frame cost */
+	double cost_dev;	/* moving average of its absolute deviation */
+	unsigned int hits;
+	unsigned int misses;
+	unsigned int backoff_frame;	/* first frame started after the last back-off */
+} TDJit;
+
+/* a vblank as seen by the vblank thread */
+typedef struct {
+	uint64_t t;		/* CLOCK_MONOTONIC ns after the wait returned */
+	unsigned int count;	/* GLX_SGI_video_sync counter */
+} TDVblank;
+
+#define VBLANK_RING_SIZE	1024
+#define VBLANK_HISTORY		256	/* must be a power of two */
+
+typedef struct {
+	int enabled;
+	int active;
+	GLFWwindow *win;	/* hidden window providing the context */
+#if defined(LINUX)
+	Display *dpy;
+	Window drawable;	/* the main window */
+#endif
+	TDThread thread;
+	TDSpscRing ring;
+	unsigned int run;
+	unsigned int running;	/* cleared by the thread when it exits */
+	/* only used by the main thread */
+	TDVblank history[VBLANK_HISTORY];
+	unsigned int received;
+	unsigned int missed;	/* gaps in the counter */
+} TDVblankThread;
+
+/* log-linear histogram of nanosecond values: values below 2*HIST_SUB_COUNT
+ * are counted exactly, above that every power of two is split into
+ * HIST_SUB_COUNT buckets (relative error < 1/HIST_SUB_COUNT) */
+#define HIST_SUB_BITS 6
+#define HIST_SUB_COUNT (1U<<HIST_SUB_BITS)
+#define HIST_MAX_BITS 36
+#define HIST_BUCKETS ((HIST_MAX_BITS - HIST_SUB_BITS + 1) * HIST_SUB_COUNT)
+
+typedef struct {
+	unsigned int count[HIST_BUCKETS];
+	uint64_t total;
+	uint64_t min;
+	uint64_t max;
+	double sum;
+} TDHistogram;
+
+typedef enum {
+	TDSTAT_FRAME_TIME=0,
+	TDSTAT_SWAP_CALL,
+	TDSTAT_LATENCY,
+	TDSTAT_CPU_RECORD,
+	TDSTAT_SUBMIT,
+	TDSTAT_GPU_EXEC,
+	TDSTAT_SWAP_QUEUE,
+	TDSTAT_DISPLAY,
+	TDSTAT_VBLANK,
+	TDSTAT_FENCE_WAIT,
+	TDSTAT_CAP_ERROR,
+	TDSTAT_JIT,
+	TDSTAT_UPLOAD_CPU,
+	TDSTAT_UPLOAD_GPU,
+	TDSTAT_COUNT
+} TDStatMetric;
+
+typedef enum {
+	TDSCOPE_INTERVAL=0,
+	TDSCOPE_TOTAL,
+	TDSCOPE_COUNT
+} TDStatScope;
+
+/* classification of frames by the number of refreshes they were shown,
+ * compared to the swap interval */
+#define JUDDER_LATE_MAX	4	/* late by 1, 2, 3 and 4 or more refreshes */
+#define JUDDER_WORST	4	/* number of worst bursts kept */
+
+typedef struct {
+	uint64_t t_start;	/* swap return of the first frame of the burst */
+	unsigned int frame;
+	unsigned int frames;
+	unsigned int refreshes;	/* sum of the deviations of all its frames */
+} TDJudderBurst;
+
+typedef struct {
+	unsigned int on_time;
+	unsigned int early;
+	unsigned int late[JUDDER_LATE_MAX];
+	unsigned int missed;	/* refreshes missed by late frames */
+	unsigned int unclassified;
+	unsigned int run;	/* current run of on-time frames */
+	unsigned int longest_run;
+	unsigned int bursts;
+	unsigned int longest_burst;
+	TDJudderBurst cur;	/* burst in progress, if frames > 0 */
+	TDJudderBurst worst[JUDDER_WORST];
+} TDJudder;
+
+typedef struct {
+	TDHistogram hist[TDSTAT_COUNT];
+	TDJudder judder;
+	unsigned int complete[TDCOMPLETE_COUNT];
+	unsigned int jit_missed;
+	unsigned int frames;
+	unsigned int dropped;
+} TDStats;
+
+/* CPU contention: a pool of worker threads which load the CPU with a duty
+ * cycle, so the render thread has to compete for cores, caches and memory
+ * bandwidth */
+typedef enum {
+	TDWORKLOAD_SPIN=0,	/* integer ALU */
+	TDWORKLOAD_STREAM,	/* sequential memory read and write */
+	TDWORKLOAD_THRASH,	/* random cache line accesses */
+	TDWORKLOAD_SIMD,	/* widest available FP vector math */
+	TDWORKLOAD_COUNT
+} TDWorkload;
+
+#define CONTENTION_THREADS_MAX	64
+#define CONTENTION_PERIOD_NS	10000000ULL
+#define CONTENTION_MEMORY	(64*1024*1024)
+
+struct TDContention;
+
+typedef struct {
+	struct TDContention *pool;
+	TDThread thread;
+	int cpu;		/* -1: not pinned */
+	uint64_t *mem;
+	uint64_t pos;
+	uint64_t sink;		/* results, so the work can't be optimized away */
+	unsigned int chunks;	/* work done, read by the render thread */
+} TDWorker;
+
+typedef struct TDContention {
+	unsigned int threads;	/* configured */
+	unsigned int duty;	/* busy percent of each CONTENTION_PERIOD_NS */
+	TDWorkload workload;
+	int cpu[CONTENTION_THREADS_MAX];
+	unsigned int cpus;	/* 0: no affinity */
+	unsigned int active;	/* threads running */
+	unsigned int run;
+	unsigned int cur_duty;		/* shared with the workers */
+	unsigned int cur_workload;
+	TDWorker worker[CONTENTION_THREADS_MAX];
+	TDHistogram frame_time[2];	/* without and with contention */
+} TDContention;
+
+/* background rendering: a helper thread with a second GL context, shared
+ * with the main window, uploads data and renders into textures, which the
+ * render thread shows; the textures are handed over triple buffered */
+typedef enum {
+	TDSHARED_UPLOAD=0,	/* CPU time of glTexSubImage2D */
+	TDSHARED_SUBMIT,	/* CPU time of the draw, fences and glFlush */
+	TDSHARED_GPU,		/* waiting for the previous frame to complete */
+	TDSHARED_FRAME,		/* time between produced frames */
+	TDSHARED_METRIC_COUNT
+} TDSharedMetric;
+
+#define SHARED_TEXTURES	3
+#define SHARED_SIZE	1024
+#define SHARED_MAX	64U
+#define SHARED_NEW	0x4	/* TDShared.middle was not shown yet */
+
+typedef struct {
+	unsigned int size;		/* MiB uploaded per produced frame, 0: off */
+	double fps;			/* production rate, 0: as fast as possible */
+	GLFWwindow *win;		/* hidden window of the shared context */
+	TDThread thread;
+	unsigned int active;
+	unsigned int run;
+	unsigned int cur_size;		/* configuration of the running thread */
+	double cur_fps;
+	GLuint tex[SHARED_TEXTURES];	/* shared between both contexts */
+	GLuint fbo;			/* window context, to blit them */
+	GLsync ready[SHARED_TEXTURES];	/* rendering done, from the helper */
+	GLsync released[SHARED_TEXTURES];	/* shown, from the render thread */
+	unsigned int front;		/* owned by the render thread */
+	unsigned int middle;		/* exchanged by both threads */
+	unsigned int produced;
+	unsigned int shown;
+	TDHistogram hist[TDSHARED_METRIC_COUNT];	/* written by the helper */
+	TDHistogram latency[2];		/* without and with the helper */
+} TDShared;
+
+/* time from a fullscreen switch request to the first frame after it */
+typedef struct {
+	uint64_t t_request;	/* 0: no switch in progress */
+	int recreate;		/* the switch in progress recreates the window */
+	int applied;
+	TDHistogram time[2];	/* in place and recreated */
+} TDWinSwitch;
+
+/* the user-controllable settings, as reported in the benchmark results */
+typedef struct {
+	TDDisplayMode mode;
+	TDSwapControlMode swapControlMode;
+	int swapInterval;
+	unsigned int ctx_flags;
+	unsigned int win_flags;
+	uint64_t busy_wait_ns;
+	uint64_t sleep_ns;
+	unsigned int frames_in_flight;
+	TDWaitStrategy fence_wait;
+	double fps_cap;
+	int jit;
+	uint64_t jit_margin_ns;
+	unsigned int gpu_iterations;
+	unsigned int gpu_memory;
+	unsigned int passes;
+	unsigned int samples;
+	unsigned int scale;
+	unsigned int workers;
+	unsigned int duty;
+	TDWorkload workload;
+	unsigned int draws;
+	TDDrawMethod draw_method;
+	unsigned int upload;
+	TDUploadMethod upload_method;
+	unsigned int shared;
+	double shared_fps;
+} TDSettings;
+
+/* one step of a scenario, only the settings flagged in set are applied */
+typedef struct {
+	char *label;
+	unsigned int set;
+	TDSettings settings;
+	unsigned int warmup;
+	uint64_t duration_ns;
+	/* results */
+	TDSettings applied;
+	unsigned int measured;
+	uint64_t t_start;
+	uint64_t t_end;
+	TDStats stats;
+} TDScenarioStep;
+
+/* scenario step settings */
+#define TDSTEP_MODE		0x1
+#define TDSTEP_SWAP_CONTROL	0x2
+#define TDSTEP_INTERVAL		0x4
+#define TDSTEP_SLEEP		0x8
+#define TDSTEP_BUSY_WAIT	0x10
+#define TDSTEP_FLUSH		0x20
+#define TDSTEP_FINISH		0x40
+#define TDSTEP_FULLSCREEN	0x80
+#define TDSTEP_WARMUP		0x100
+#define TDSTEP_IN_FLIGHT	0x200
+#define TDSTEP_FENCE_WAIT	0x400
+#define TDSTEP_FPS_CAP		0x800
+#define TDSTEP_JIT		0x1000
+#define TDSTEP_GPU_ITERATIONS	0x2000
+#define TDSTEP_GPU_MEMORY	0x4000
+#define TDSTEP_PASSES		0x8000
+#define TDSTEP_SAMPLES		0x10000
+#define TDSTEP_SCALE		0x20000
+#define TDSTEP_WORKERS		0x40000
+#define TDSTEP_DUTY		0x80000
+#define TDSTEP_WORKLOAD		0x100000
+#define TDSTEP_DRAWS		0x200000
+#define TDSTEP_DRAW_METHOD	0x400000
+#define TDSTEP_UPLOAD		0x800000
+#define TDSTEP_UPLOAD_METHOD	0x1000000
+#define TDSTEP_SHARED		0x2000000
+#define TDSTEP_SHARED_FPS	0x4000000
+
+typedef struct {
+	TDScenarioStep *step;
+	unsigned int count;
+	unsigned int cur;
+	unsigned int warmup_left;
+} TDScenario;
+
+/* auto tuning: every candidate is a point on the grid of the tuned
+ * parameters, and is measured as one scenario step */
+typedef enum {
+	TDTUNE_SLEEP=0,
+	TDTUNE_BUSY_WAIT,
+	TDTUNE_IN_FLIGHT,
+	TDTUNE_SYNC,
+	TDTUNE_COUNT
+} TDTuneParam;
+
+/* what a candidate achieved, all objectives are minimized */
+typedef struct {
+	double latency;		/* 99th percentile of the latency in ns */
+	double missed;		/* missed refreshes per frame */
+	double frame_time;	/* average frame time in ns (inverse throughput) */
+} TDTuneResult;
+
+typedef struct {
+	unsigned char level[TDTUNE_COUNT];
+	unsigned int tried;	/* neighbour moves already tried, bit per move */
+	int scored;		/* result is valid */
+	TDTuneResult result;
+} TDTuneCandidate;
+
+typedef struct {
+	unsigned int max;	/* candidate budget, 0: no auto tuning */
+	TDTuneCandidate *cand;	/* one per scenario step */
+	unsigned int count;
+	int waiting;		/* for the frames of the last step to be done */
+} TDTune;
+
+/* non-interactive benchmark mode */
+typedef struct {
+	int active;
+	unsigned int warmup;
+	uint64_t duration_ns;
+	const char *json;
+	unsigned int frames;
+	unsigned int measured;
+	uint64_t t_start;
+	uint64_t t_end;
+	TDSettings settings;
+	TDScenario scenario;
+	TDTune tune;
+} TDBench;
 
 typedef struct {
 	TDWindow win;
@@ -76,14 +798,39 @@ typedef struct {
 	TDSwapControlMode swapControlMode;
 	TDPulse pulse;
 	TDBars bars;
+	TDLoad load;
+	TDPipeline pipeline;
+	TDDraws draws;
+	TDUpload upload;
 	int swapInterval;
 	unsigned int flags;
 	unsigned int frame;
 	unsigned int frame_int;
 	GLfloat delta;
 	GLfloat time;
-	GLuint timer_query_obj[TIMER_QUERY_COUNT];
-	GLuint64 timestamp[TIMER_QUERY_COUNT];
+	TDQueryRing queries;
+	TDPresent present;
+	TDTelemetry telemetry;
+	TDFrameLimiter limiter;
+	TDFrameCap cap;
+	double fps_cap;			/* 0: no frame rate cap */
+	TDJit jit;
+	int jit_enabled;
+	TDContention contention;
+	TDShared shared;
+	TDWinSwitch win_switch;
+	unsigned int frames_in_flight;	/* 0: not limited */
+	TDWaitStrategy fence_wait;
+	TDClockCalib clock;
+	TDVblankThread vblank;
+	TDRefreshEst refresh;
+	TDStats stats[TDSCOPE_COUNT];
+	unsigned int stat_scopes;
+	TDStats *stat_step;
+	uint64_t prev_swap_ret;
+	int64_t prev_msc;
+	unsigned int prev_step;	/* scenario step of the previous frame done */
+	TDBench bench;
 	double avg_lat;
 	double avg_fps;
 	double cur_lat;
@@ -98,12 +845,22 @@ typedef struct {
 #define TDCTX_BINDING_EXTENSIONS_LOADED 0x8
 #define TDCTX_GL_FLUSH		0x10
 #define TDCTX_GL_FINISH		0x20
+#define TDCTX_SWAP_INTERVAL_APPLY 0x40
+#define TDCTX_GL_OBJECTS	0x80	/* shared GL objects were created */
+#define TDCTX_SWITCH_WINDOW	0x100	/* switch fullscreen in place */
+#define TDCTX_FULLSCREEN_RECREATE 0x200	/* always recreate the window instead */
 #define TDCTX_FLAGS_DEFAULT	TDCTX_RUN
 
 /****************************************************************************
  * CONSOLE OUTPUT                                                           *
  ****************************************************************************/
 
+#if defined(WIN32)
+#define my_snprintf sprintf_s
+#else
+#define my_snprintf snprintf
+#endif
+
 static void
 error(int exit_code, const char *fmt, ...)
 {
@@ -116,12 +873,19 @@ error(int exit_code, const char *fmt, ...)
 	exit(exit_code);
 }
 
+#define INFO_LEVEL_DEFAULT 5
+
+/* messages with a level above this are suppressed */
+static int info_level=INFO_LEVEL_DEFAULT;
+
 static void
 info(int level, const char *fmt, ...)
 {
 	va_list args;
 
-	(void)level;
+	if (level > info_level) {
+		return;
+	}
 	va_start(args, fmt);
 	vfprintf(stdout, fmt, args);
 	va_end(args);
@@ -175,477 +939,4366 @@ sleep_nanoseconds(uint64_t amount)
 	} while (repeat);
 }
 
-/****************************************************************************
- * GL WINDOW                                                                *
- ****************************************************************************/
-
+/* sleep until the absolute time deadline, as returned by get_current_time */
 static void
-td_win_init(TDWindow *w)
+sleep_until_nanoseconds(uint64_t deadline)
 {
-	w->win=NULL;
-	w->windowed_pos[0]=100;
-	w->windowed_pos[1]=100;
-	w->windowed_size[0]=800;
-	w->windowed_size[1]=600;
-	w->flags=TDWIN_FLAGS_DEFAULT;
+#if defined(WIN32)
+	uint64_t now=get_current_time();
+	if (deadline > now) {
+		sleep_nanoseconds(deadline - now);
+	}
+#else
+	struct timespec ts;
 
-	w->pos[0]=w->windowed_pos[0];
-	w->pos[1]=w->windowed_pos[1];
-	w->size[0]=w->windowed_size[0];
-	w->size[1]=w->windowed_size[1];
+	ts.tv_sec=(time_t)(deadline / 1000000000ULL);
+	ts.tv_nsec = (long)(deadline % 1000000000ULL);
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+#endif
 }
 
+/* tell the CPU we are spinning */
 static void
-td_win_destroy(TDWindow *w)
+cpu_pause(void)
 {
-	if (w) {
-		if (w->win) {
-			glfwDestroyWindow(w->win);
-			info(1,"destroyed GL window");
-			w->win=NULL;
-		}
-	}
+#if defined(_MSC_VER)
+	YieldProcessor();
+#elif defined(__i386__) || defined(__x86_64__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+	__asm__ __volatile__("yield");
+#endif
 }
 
-static int
-td_win_create(TDWindow *w)
-{
-	GLFWmonitor *monitor=NULL;
+/****************************************************************************
+ * THREADS AND ATOMICS                                                      *
+ ****************************************************************************/
 
-	td_win_destroy(w);
+#if defined(_MSC_VER)
+static unsigned int
+td_atomic_load(const unsigned int *ptr)
+{
+	unsigned int val=*(const volatile unsigned int *)ptr;
+	_ReadWriteBarrier();
+	return val;
+}
 
-	glfwDefaultWindowHints();
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
-	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-	glfwWindowHint(GLFW_DECORATED, (w->flags & TDWIN_DECORATED)?GL_TRUE:GL_FALSE);
-	if (w->flags & TDWIN_FULLSCREEN) {
-		monitor=glfwGetPrimaryMonitor();
-		if (monitor) {
-			const GLFWvidmode *videoMode=glfwGetVideoMode(monitor);
-			if (videoMode) {
-				// resolution
-				w->size[0]=videoMode->width;
-				w->size[1]=videoMode->height;
-				w->pos[0]=0;
-				w->pos[1]=0;
-				if (w->flags & TDWIN_FULLSCREEN_MODE_SWITCH) {
-					// color bit depths
-					glfwWindowHint(GLFW_RED_BITS, videoMode->redBits);
-					glfwWindowHint(GLFW_GREEN_BITS, videoMode->greenBits);
-					glfwWindowHint(GLFW_BLUE_BITS, videoMode->blueBits);
-					// refresh rate
-					glfwWindowHint(GLFW_REFRESH_RATE, videoMode->refreshRate);
-				} else {
-					monitor=NULL;
-				}
-			} else {
-				warn("failed to get video mode");
-			}
-		} else {
-			warn("failed to get primary monitor");
-		}
-	} else {
-		w->pos[0]=w->windowed_pos[0];
-		w->pos[1]=w->windowed_pos[1];
-		w->size[0]=w->windowed_size[0];
-		w->size[1]=w->windowed_size[1];
-	}
+static void
+td_atomic_store(unsigned int *ptr, unsigned int val)
+{
+	_ReadWriteBarrier();
+	*(volatile unsigned int *)ptr=val;
+}
 
-	if ( !(w->win=glfwCreateWindow( w->size[0], w->size[1], APPTITLE, monitor, NULL)) ) {
-		return -1;
-	}
-	if (!monitor) {
-		glfwSetWindowPos(w->win, w->pos[0], w->pos[1]);
-	}
+static unsigned int
+td_atomic_exchange(unsigned int *ptr, unsigned int val)
+{
+	return (unsigned int)InterlockedExchange((volatile LONG*)ptr, (LONG)val);
+}
 
-	info(1,"created new GL window (%dx%d)",w->size[0],w->size[1]);
-	glfwMakeContextCurrent(w->win);
-	if (!gladLoadGL()) {
-		warn("failed to initialize GLAD");
-		return -2;
-	}
-	return 0;
+static void
+td_atomic_fence(void)
+{
+	MemoryBarrier();
+}
+#else
+static unsigned int
+td_atomic_load(const unsigned int *ptr)
+{
+	return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
 }
 
-/****************************************************************************
- * GL HELPER                                                                *
- ****************************************************************************/
+static void
+td_atomic_store(unsigned int *ptr, unsigned int val)
+{
+	__atomic_store_n(ptr, val, __ATOMIC_RELEASE);
+}
 
-static GLuint make_shader(const GLchar *src, GLenum type)
+static unsigned int
+td_atomic_exchange(unsigned int *ptr, unsigned int val)
 {
-	GLint status=GL_FALSE;
-	GLuint sh=glCreateShader(type);
-	if (sh) {
-		glShaderSource(sh, 1, &src, NULL);
-		glCompileShader(sh);
-		glGetShaderiv(sh, GL_COMPILE_STATUS, &status);
-		if (status != GL_TRUE) {
-			GLchar buf[8192];
-			glGetShaderInfoLog(sh, sizeof(buf), NULL, buf);
-			warn("shader compilation failed: %s", buf);
-		}
-	}
-	return sh;
+	return __atomic_exchange_n(ptr, val, __ATOMIC_ACQ_REL);
 }
 
-static GLuint make_program(const GLchar *vs, const GLchar *fs)
+static void
+td_atomic_fence(void)
 {
-	GLuint sh_vs, sh_fs, prog;
-	GLint status=GL_FALSE;
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+#endif
 
-	sh_vs=make_shader(vs, GL_VERTEX_SHADER);
-	sh_fs=make_shader(fs, GL_FRAGMENT_SHADER);
-	prog=glCreateProgram();
-	glAttachShader(prog, sh_vs);
-	glAttachShader(prog, sh_fs);
-	glLinkProgram(prog);
-	glGetProgramiv(prog, GL_LINK_STATUS, &status);
-	if (status != GL_TRUE) {
-		GLchar buf[8192];
-		glGetProgramInfoLog(prog, sizeof(buf), NULL, buf);
-		warn("program link failed: %s",buf);
+static int
+td_thread_create(TDThread *thread, TDThreadFunc func, void *arg)
+{
+#if defined(WIN32)
+	*thread=CreateThread(NULL, 0, func, arg, 0, NULL);
+	return (*thread)?0:-1;
+#else
+	return pthread_create(thread, NULL, func, arg)?-1:0;
+#endif
+}
 
-	} else {
-		info(5,"program %u linked successfully", prog);
+static void
+td_thread_yield(void)
+{
+#if defined(WIN32)
+	SwitchToThread();
+#else
+	sched_yield();
+#endif
+}
+
+/* CPUs a thread can be pinned to */
+#if defined(WIN32)
+#define AFFINITY_CPUS_MAX	((long)sizeof(DWORD_PTR)*8)
+#elif defined(LINUX)
+#define AFFINITY_CPUS_MAX	((long)CPU_SETSIZE)
+#else
+#define AFFINITY_CPUS_MAX	0L
+#endif
+
+/* pin the calling thread to one CPU */
+static int
+td_thread_set_affinity(int cpu)
+{
+	if (cpu < 0 || cpu >= AFFINITY_CPUS_MAX) {
+		return -1;
 	}
-	glDetachShader(prog, sh_fs);
-	glDetachShader(prog, sh_vs);
-	glDeleteShader(sh_vs);
-	glDeleteShader(sh_fs);
-	return prog;
+#if defined(WIN32)
+	return (SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << cpu))?0:-1;
+#elif defined(LINUX)
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	return pthread_setaffinity_np(pthread_self(), sizeof(set), &set)?-1:0;
+#else
+	(void)cpu;
+	return -1;
+#endif
+}
+
+static void
+td_thread_join(TDThread thread)
+{
+#if defined(WIN32)
+	WaitForSingleObject(thread, INFINITE);
+	CloseHandle(thread);
+#else
+	pthread_join(thread, NULL);
+#endif
 }
 
 /****************************************************************************
- * DIFFERENT DISPLAY MODES                                                  *
+ * LOCK-FREE RING BUFFER                                                    *
  ****************************************************************************/
 
-/* ----------------------- TDDISP_NONE ------------------------------------*/
+/* size must be a power of two */
+static int
+td_spsc_init(TDSpscRing *ring, size_t elem_size, unsigned int size)
+{
+	ring->data=malloc(elem_size * size);
+	ring->elem_size=elem_size;
+	ring->mask=size-1;
+	ring->overflow=0;
+	ring->head=0;
+	ring->tail=0;
+	return (ring->data)?0:-1;
+}
 
 static void
-td_disp_none(TDContext *ctx)
+td_spsc_destroy(TDSpscRing *ring)
 {
-	(void)ctx;
+	free(ring->data);
+	ring->data=NULL;
 }
 
-/* ----------------------- TDDISP_COLORS ----------------------------------*/
+/* producer side: never blocks, drops the element if the ring is full */
+static int
+td_spsc_push(TDSpscRing *ring, const void *elem)
+{
+	unsigned int head=ring->head;
 
-static void
-td_disp_colors(TDContext *ctx)
+	if (head - td_atomic_load(&ring->tail) > ring->mask) {
+		ring->overflow++;
+		return -1;
+	}
+	memcpy(ring->data + (size_t)(head & ring->mask) * ring->elem_size, elem, ring->elem_size);
+	td_atomic_store(&ring->head, head+1);
+	return 0;
+}
+
+/* consumer side: returns 1 if an element was fetched and 0 if empty */
+static int
+td_spsc_pop(TDSpscRing *ring, void *elem)
 {
-	static const GLfloat colors[][4]={
-		{1.0f, 0.0f, 0.0f, 1.0f},
-		{0.0f, 1.0f, 0.0f, 1.0f},
-		{0.0f, 0.0f, 1.0f, 1.0f},
-		{1.0f, 1.0f, 0.0f, 1.0f},
-		{0.0f, 0.0f, 0.0f, 1.0f},
-		{0.0f, 1.0f, 1.0f, 1.0f},
-		{1.0f, 0.0f, 1.0f, 1.0f},
-		{1.0f, 1.0f, 1.0f, 1.0f}
-	};
-	const GLfloat *c=&colors[ctx->frame % 8][0];
-	glClearColor(c[0], c[1], c[2], c[3]);
-	glClear(GL_COLOR_BUFFER_BIT);
+	unsigned int tail=ring->tail;
+
+	if (td_atomic_load(&ring->head) == tail) {
+		return 0;
+	}
+	memcpy(elem, ring->data + (size_t)(tail & ring->mask) * ring->elem_size, ring->elem_size);
+	td_atomic_store(&ring->tail, tail+1);
+	return 1;
 }
 
-/* ------------------------ TDDISP_PULSE ----------------------------------*/
+/****************************************************************************
+ * TELEMETRY                                                                *
+ * The render thread pushes one TDFrameRecord per frame into a ring buffer, *
+ * a background thread drains it into a CSV file, so that no I/O is done    *
+ * on the render thread.                                                    *
+ ****************************************************************************/
 
 static void
-td_disp_pulse_init(TDPulse *pulse)
+td_telemetry_init(TDTelemetry *t)
 {
-	pulse->speed=3.0f;
+	t->filename=NULL;
+	t->file=NULL;
+	t->run=0;
+	t->written=0;
+	t->active=0;
+	t->ring.data=NULL;
+	t->ring.overflow=0;
 }
 
+static const char *td_complete_name[TDCOMPLETE_COUNT]={
+	"unknown",
+	"copy",
+	"flip",
+	"skip",
+	"suboptimal_copy"
+};
+
 static void
-td_disp_pulse(TDContext *ctx)
+td_telemetry_write(TDTelemetry *t, const TDFrameRecord *rec)
 {
-	GLfloat v=sinf(ctx->time * ctx->pulse.speed)*0.5f+0.5f;
-	glClearColor(v,v,v,1.0f);
-	glClear(GL_COLOR_BUFFER_BIT);
+	fprintf(t->file, "%u,%u,%llu,%llu,%llu,%llu,%llu,%lld,%u,%llu,%llu,%llu,%llu,%lld,%llu,%lld,%lld,%s,%llu,%u,%llu,%lld,%llu,%llu,%llu\n",
+		rec->frame, rec->step,
+		(unsigned long long)rec->t_poll, (unsigned long long)rec->t_draw,
+		(unsigned long long)rec->t_swap, (unsigned long long)rec->t_swap_ret,
+		(unsigned long long)rec->gpu[TDPROBE_SWAP_END], (long long)rec->latency, rec->flags,
+		(unsigned long long)rec->gpu[TDPROBE_FRAME_BEGIN],
+		(unsigned long long)rec->gpu[TDPROBE_DRAW_END],
+		(unsigned long long)rec->gpu[TDPROBE_SWAP_BEGIN],
+		(unsigned long long)rec->gpu[TDPROBE_DRAW_TIME],
+		(long long)rec->gl_offset,
+		(unsigned long long)rec->t_present, (long long)rec->msc, (long long)rec->sbc,
+		td_complete_name[rec->complete],
+		(unsigned long long)rec->t_vblank, rec->vblank_count,
+		(unsigned long long)rec->fence_wait, (long long)rec->cap_error,
+		(unsigned long long)rec->jit_target, (unsigned long long)rec->upload_cpu,
+		(unsigned long long)((rec->flags & TDFRAME_UPLOAD)?
+			(rec->gpu[TDPROBE_UPLOAD_END] - rec->gpu[TDPROBE_UPLOAD_BEGIN]):0));
+	t->written++;
 }
 
-/* ----------------------- TDDISP_BARS -----------------------------------*/
-
-static const GLchar *td_disp_bars_vs="#version 330 core\n"
-	"void main() {\n"
-	"	vec2 pos=vec2( (gl_VertexID & 2)>>1, 1 - (gl_VertexID & 1));\n"
-	"	gl_Position=vec4(pos*2.0-1.0,0,1);\n"
-	"}\n";
+TD_THREAD_FUNC(td_telemetry_thread, arg)
+{
+	TDTelemetry *t=arg;
+	TDFrameRecord rec;
+	int running;
 
-static const GLchar *td_disp_bars_fs="#version 330 core\n"
-	"out vec4 color;\n"
-	"uniform vec3 data;\n"
-	"void main() {\n"
-	"	vec3 c[2]=vec3[2](vec3(0.0f, 0.0f, 0.0f),vec3(1.0f,1.0f,1.0f));\n"
-	"	color=vec4(c[(int(gl_FragCoord.x + data.z)/int(data.x))%2] ,1);\n"
-	"}\n";
+	do {
+		unsigned int cnt=0;
+		running=(int)td_atomic_load(&t->run);
+		while (td_spsc_pop(&t->ring, &rec)) {
+			td_telemetry_write(t, &rec);
+			cnt++;
+		}
+		if (cnt) {
+			fflush(t->file);
+		} else if (running) {
+			sleep_nanoseconds(5000000);
+		}
+	} while (running);
+	TD_THREAD_RETURN;
+}
 
-static void
-td_disp_bars_init(TDBars *bars)
+static int
+td_telemetry_start(TDTelemetry *t)
 {
-	bars->program=0;
-	bars->vao=0;
-	bars->loc_data=-1;
-	bars->data[0]=32.0f;
-	bars->data[1]=16.0f*bars->data[0];
-	bars->data[2]=0.0f;
+	if (!t->filename) {
+		return 0;
+	}
+	if (!(t->file=fopen(t->filename, "w"))) {
+		warn("failed to open telemetry file '%s'", t->filename);
+		return -1;
+	}
+	if (td_spsc_init(&t->ring, sizeof(TDFrameRecord), TELEMETRY_RING_SIZE)) {
+		warn("failed to allocate telemetry ring buffer");
+		fclose(t->file);
+		t->file=NULL;
+		return -1;
+	}
+	fprintf(t->file, "frame,step,t_poll_ns,t_draw_ns,t_swap_ns,t_swap_ret_ns,gpu_ts_ns,latency_ns,flags,"
+		"gpu_begin_ns,gpu_draw_end_ns,gpu_swap_begin_ns,gpu_draw_time_ns,gl_offset_ns,"
+		"t_present_ns,msc,sbc,complete,t_vblank_ns,vblank_count,fence_wait_ns,cap_error_ns,jit_target_ns,upload_cpu_ns,upload_gpu_ns\n");
+	t->run=1;
+	if (td_thread_create(&t->thread, td_telemetry_thread, t)) {
+		warn("failed to create telemetry thread");
+		td_spsc_destroy(&t->ring);
+		fclose(t->file);
+		t->file=NULL;
+		return -1;
+	}
+	t->active=1;
+	info(1,"writing per-frame telemetry to '%s'", t->filename);
+	return 0;
 }
 
 static void
-td_disp_bars_gl_init(TDBars *bars)
+td_telemetry_stop(TDTelemetry *t)
 {
-	bars->program=make_program(td_disp_bars_vs, td_disp_bars_fs);
-	bars->loc_data=glGetUniformLocation(bars->program, "data");
-	glGenVertexArrays(1, &bars->vao);
+	if (!t->active) {
+		return;
+	}
+	td_atomic_store(&t->run, 0);
+	td_thread_join(t->thread);
+	fclose(t->file);
+	t->file=NULL;
+	info(1,"wrote %u telemetry records to '%s', %u lost due to ring overflow",
+		t->written, t->filename, t->ring.overflow);
+	td_spsc_destroy(&t->ring);
+	t->active=0;
 }
 
 static void
-td_disp_bars_destroy(TDBars *bars)
+td_telemetry_push(TDTelemetry *t, const TDFrameRecord *rec)
 {
-	if (bars->program) {
-		glDeleteProgram(bars->program);
-		bars->program=0;
+	if (t->active) {
+		td_spsc_push(&t->ring, rec);
 	}
-	if (bars->vao) {
-		glDeleteVertexArrays(1, &bars->vao);
-		bars->vao=0;
+}
+
+/****************************************************************************
+ * HISTOGRAMS                                                               *
+ * constant memory, O(1) recording, see TDHistogram                        *
+ ****************************************************************************/
+
+static const char *td_stat_name[TDSTAT_COUNT]={
+	"frame",
+	"swap",
+	"lat",
+	"cpu",
+	"submit",
+	"gpu",
+	"queue",
+	"disp",
+	"vbl",
+	"fence",
+	"cap",
+	"jit",
+	"upload",
+	"xfer"
+};
+
+/* index of the most significant bit set, v must not be 0 */
+static unsigned int
+td_msb64(uint64_t v)
+{
+#if defined(__GNUC__)
+	return 63U - (unsigned int)__builtin_clzll(v);
+#else
+	unsigned int m=0;
+	while (v >>= 1) {
+		m++;
 	}
+	return m;
+#endif
 }
 
 static void
-td_disp_bars(TDContext *ctx)
+td_hist_reset(TDHistogram *h)
 {
-	ctx->bars.data[2] = fmodf(ctx->bars.data[1] * ctx->time, ctx->bars.data[0]*2.0f);
-	glClear(GL_COLOR_BUFFER_BIT);
-	glUseProgram(ctx->bars.program);
-	glUniform3fv(ctx->bars.loc_data, 1, ctx->bars.data);
-	glBindVertexArray(ctx->bars.vao);
-	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-	glUseProgram(0);
-	glBindVertexArray(0);
+	memset(h->count, 0, sizeof(h->count));
+	h->total=0;
+	h->min=0;
+	h->max=0;
+	h->sum=0.0;
 }
 
-/* --------------------------- generic ------------------------------------*/
-static void
-td_disp(TDContext *ctx)
+static unsigned int
+td_hist_index(uint64_t v)
 {
-	switch (ctx->mode) {
-		case TDDISP_NONE:
-			td_disp_none(ctx);
-			break;
-		case TDDISP_COLORS:
-			td_disp_colors(ctx);
-			break;
-		case TDDISP_PULSE:
-			td_disp_pulse(ctx);
-			break;
-		case TDDISP_BARS:
-			td_disp_bars(ctx);
-			break;
-		default:
-			info(0,"invalid display mode 0x%x",(unsigned)ctx->mode);
+	unsigned int m;
+
+	if (v < 2*HIST_SUB_COUNT) {
+		return (unsigned int)v;
 	}
+	m=td_msb64(v);
+	if (m >= HIST_MAX_BITS) {
+		return HIST_BUCKETS-1;
+	}
+	return (m - HIST_SUB_BITS + 1) * HIST_SUB_COUNT +
+		(unsigned int)(v >> (m - HIST_SUB_BITS)) - HIST_SUB_COUNT;
+}
 
-	if (ctx->flags & TDCTX_GL_FLUSH) {
-		glFlush();
+/* the value in the middle of a bucket */
+static uint64_t
+td_hist_value(unsigned int idx)
+{
+	unsigned int shift;
+	uint64_t sub;
+
+	if (idx < 2*HIST_SUB_COUNT) {
+		return idx;
 	}
+	shift=idx / HIST_SUB_COUNT - 1;
+	sub=(uint64_t)(idx % HIST_SUB_COUNT + HIST_SUB_COUNT);
+	return (sub << shift) + ((1ULL << shift) >> 1);
+}
 
-	if (ctx->flags & TDCTX_GL_FINISH) {
-		glFinish();
+static void
+td_hist_record(TDHistogram *h, uint64_t v)
+{
+	h->count[td_hist_index(v)]++;
+	if (!h->total || v < h->min) {
+		h->min=v;
 	}
+	if (v > h->max) {
+		h->max=v;
+	}
+	h->total++;
+	h->sum += (double)v;
+}
 
-	if (ctx->busy_wait_ns) {
-		uint64_t now = get_current_time();
-		volatile int i;
-		while (get_current_time() - now < ctx->busy_wait_ns) {
-			i++;
-		}	
-		(void)i;
+/* value at percentile p (0 to 100) */
+static uint64_t
+td_hist_percentile(const TDHistogram *h, double p)
+{
+	uint64_t target,cnt=0;
+	unsigned int i;
+
+	if (!h->total) {
+		return 0;
 	}
-	if (ctx->sleep_ns) {
-		sleep_nanoseconds(ctx->sleep_ns);
+	target=(uint64_t)ceil(p / 100.0 * (double)h->total);
+	if (target < 1) {
+		target=1;
 	}
+	for (i=0; i<HIST_BUCKETS; i++) {
+		cnt += h->count[i];
+		if (cnt >= target) {
+			uint64_t v=td_hist_value(i);
+			if (v < h->min) {
+				v=h->min;
+			}
+			if (v > h->max) {
+				v=h->max;
+			}
+			return v;
+		}
+	}
+	return h->max;
 }
 
-/****************************************************************************
- * WINDOW TITLE                                                             *
- ****************************************************************************/
+static double
+td_hist_mean(const TDHistogram *h)
+{
+	return (h->total)?(h->sum / (double)h->total):0.0;
+}
 
-#if defined(WIN32)
-#define my_snprintf sprintf_s
-#else
-#define my_snprintf snprintf
-#endif
+/* format "p50/p90/p99/p99.9/max" in milliseconds */
+static void
+td_hist_format(const TDHistogram *h, char *buf, size_t size)
+{
+	my_snprintf(buf, size, "%.3f/%.3f/%.3f/%.3f/%.3fms",
+		td_hist_percentile(h, 50.0)/1000000.0,
+		td_hist_percentile(h, 90.0)/1000000.0,
+		td_hist_percentile(h, 99.0)/1000000.0,
+		td_hist_percentile(h, 99.9)/1000000.0,
+		h->max/1000000.0);
+}
 
 static void
-td_ctx_set_title(TDContext *ctx)
+td_stats_reset(TDStats *stats)
 {
-	char title[2048],swapi[64];
-	if (ctx->flags & TDCTX_SWAP_INTERVAL_SET) {
-		my_snprintf(swapi,sizeof(swapi),"%d",ctx->swapInterval);
-	} else {
-		my_snprintf(swapi,sizeof(swapi),"unset");
-	}
-	my_snprintf(title, sizeof(title),
-		APPTITLE": [%u:%s] %.2fFPS, lat: %.3fms, cur_lat: %.3fms%s%s, sleep: %.1fms, busywait: %.1fms", 
-		(unsigned)ctx->swapControlMode, swapi, ctx->avg_fps, ctx->avg_lat, ctx->cur_lat, 
-		((ctx->flags & TDCTX_GL_FLUSH)?", flush":""),
-		((ctx->flags & TDCTX_GL_FINISH)?", finish":""),
-		ctx->sleep_ns / 1000000.0, ctx->busy_wait_ns/1000000.0);
-	if (ctx->win.flags & TDWIN_DECORATED) {
-		glfwSetWindowTitle(ctx->win.win, title);
+	int i;
+
+	for (i=0; i<TDSTAT_COUNT; i++) {
+		td_hist_reset(&stats->hist[i]);
 	}
-	info(0,"%s",title);
+	memset(&stats->judder, 0, sizeof(stats->judder));
+	memset(stats->complete, 0, sizeof(stats->complete));
+	stats->jit_missed=0;
+	stats->frames=0;
+	stats->dropped=0;
 }
 
 /****************************************************************************
- * SWAP_CONTROL                                                             *
+ * GL WINDOW                                                                *
  ****************************************************************************/
 
 static void
-td_ctx_set_swap_interval(TDContext *ctx)
+td_win_init(TDWindow *w)
 {
-	const char *func="NONE";
-#if defined(WIN32)
-	if (!(ctx->flags & TDCTX_BINDING_EXTENSIONS_LOADED)) {
-		HWND hwin=glfwGetWin32Window(ctx->win.win);
-		HDC hdc=GetDC(hwin);
-		if (!gladLoadWGL(hdc)) {
-			warn("failed to load WGL extensions");
-			ReleaseDC(hwin,hdc);
-			return;
-		}
-		ReleaseDC(hwin,hdc);
-		info(2,"loaded WGL extensions");
-		ctx->flags |= TDCTX_BINDING_EXTENSIONS_LOADED;
-	}
-	switch(ctx->swapControlMode) {
-		case TDSWAP_CONTROL_EXT:
-			func="EXT";
-			if (GLAD_WGL_EXT_swap_control) {
-				wglSwapIntervalEXT(ctx->swapInterval);
-			} else {
-				warn("wglSwapIntervalEXT not available");
-				return;
-			}
-			break;
-		default:
-			warn("swap control mode %u not available", (unsigned)ctx->swapControlMode);
-			return;
-	}
-	info(0,"setting swap interval to %d [wglSwapInterval%s]", ctx->swapInterval, func);
-#elif defined(LINUX)
-	Display *dpy = glfwGetX11Display();
+	w->win=NULL;
+	w->share=NULL;
+	w->windowed_pos[0]=100;
+	w->windowed_pos[1]=100;
+	w->windowed_size[0]=800;
+	w->windowed_size[1]=600;
+	w->flags=TDWIN_FLAGS_DEFAULT;
 
-	if (!(ctx->flags & TDCTX_BINDING_EXTENSIONS_LOADED)) {
-		Window win=glfwGetX11Window(ctx->win.win);
-		int screen=0;
-		XWindowAttributes attr;
-		XGetWindowAttributes(dpy, win, &attr);
-		screen=XScreenNumberOfScreen(attr.screen);
-		if (!gladLoadGLX(dpy, screen)) {
-			warn("failed to load GLX extensions");
-			return;
+	w->pos[0]=w->windowed_pos[0];
+	w->pos[1]=w->windowed_pos[1];
+	w->size[0]=w->windowed_size[0];
+	w->size[1]=w->windowed_size[1];
+}
+
+static void
+td_win_destroy(TDWindow *w)
+{
+	if (w) {
+		if (w->win) {
+			glfwDestroyWindow(w->win);
+			info(1,"destroyed GL window");
+			w->win=NULL;
 		}
-		info(2,"loaded GLX extensions");
-		ctx->flags |= TDCTX_BINDING_EXTENSIONS_LOADED;
 	}
+}
 
-	switch(ctx->swapControlMode) {
-		case TDSWAP_CONTROL_EXT:
-			func="EXT";
-			if (GLAD_GLX_EXT_swap_control) {
-				GLXDrawable drawable=glXGetCurrentDrawable(dpy);
-				if (drawable == None) {
-					warn("failed to get current GLX drawable!");
+static int
+td_win_create(TDWindow *w)
+{
+	GLFWmonitor *monitor=NULL;
+
+	td_win_destroy(w);
+
+	glfwDefaultWindowHints();
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+	glfwWindowHint(GLFW_DECORATED, (w->flags & TDWIN_DECORATED)?GL_TRUE:GL_FALSE);
+	w->refresh_rate=0;
+	if (w->flags & TDWIN_FULLSCREEN) {
+		monitor=glfwGetPrimaryMonitor();
+		if (monitor) {
+			const GLFWvidmode *videoMode=glfwGetVideoMode(monitor);
+			if (videoMode) {
+				w->refresh_rate=videoMode->refreshRate;
+				// resolution
+				w->size[0]=videoMode->width;
+				w->size[1]=videoMode->height;
+				w->pos[0]=0;
+				w->pos[1]=0;
+				if (w->flags & TDWIN_FULLSCREEN_MODE_SWITCH) {
+					// color bit depths
+					glfwWindowHint(GLFW_RED_BITS, videoMode->redBits);
+					glfwWindowHint(GLFW_GREEN_BITS, videoMode->greenBits);
+					glfwWindowHint(GLFW_BLUE_BITS, videoMode->blueBits);
+					// refresh rate
+					glfwWindowHint(GLFW_REFRESH_RATE, videoMode->refreshRate);
+				} else {
+					monitor=NULL;
 				}
-				glXSwapIntervalEXT(dpy, drawable, ctx->swapInterval);
 			} else {
-				warn("glXSwapIntervalEXT not available");
-				return;
+				warn("failed to get video mode");
 			}
-			break;
-		case TDSWAP_CONTROL_SGI:
-			func="SGI";
-			if (GLAD_GLX_SGI_swap_control) {
-				glXSwapIntervalSGI(ctx->swapInterval);
-			} else {
-				warn("glXSwapIntervalSGI not available");
-				return;
+		} else {
+			warn("failed to get primary monitor");
+		}
+	} else {
+		w->pos[0]=w->windowed_pos[0];
+		w->pos[1]=w->windowed_pos[1];
+		w->size[0]=w->windowed_size[0];
+		w->size[1]=w->windowed_size[1];
+		/* assume the window is shown on the primary monitor */
+		if ((monitor=glfwGetPrimaryMonitor())) {
+			const GLFWvidmode *videoMode=glfwGetVideoMode(monitor);
+			if (videoMode) {
+				w->refresh_rate=videoMode->refreshRate;
 			}
-			break;
-		/* TODO: glad currently does not have the MESA variant */
-		default:
-			warn("swap control mode %u not available", (unsigned)ctx->swapControlMode);
-			return;
+			monitor=NULL;
+		}
 	}
-	info(0,"setting swap interval to %d [glXSwapInterval%s]", ctx->swapInterval, func);
+
+	if ( !(w->win=glfwCreateWindow( w->size[0], w->size[1], APPTITLE, monitor, w->share)) ) {
+		return -1;
+	}
+	w->decorated=(w->flags & TDWIN_DECORATED)?1:0;
+	if (!monitor) {
+		glfwSetWindowPos(w->win, w->pos[0], w->pos[1]);
+	}
+
+	info(1,"created new GL window (%dx%d, %dHz)",w->size[0],w->size[1],w->refresh_rate);
+	glfwMakeContextCurrent(w->win);
+	if (!w->share && !gladLoadGL()) {
+		warn("failed to initialize GLAD");
+		return -2;
+	}
+	return 0;
+}
+
+/* apply the fullscreen flags to the existing window, keeping its context,
+ * returns -1 if the window has to be recreated instead; the fullscreen is
+ * always a monitor fullscreen at the current video mode here */
+static int
+td_win_switch(TDWindow *w)
+{
+	GLFWmonitor *monitor=glfwGetPrimaryMonitor();
+	const GLFWvidmode *videoMode=(monitor)?glfwGetVideoMode(monitor):NULL;
+
+	if (w->flags & TDWIN_FULLSCREEN) {
+		if (!videoMode) {
+			warn("failed to get video mode");
+			return -1;
+		}
+		w->refresh_rate=videoMode->refreshRate;
+		w->size[0]=videoMode->width;
+		w->size[1]=videoMode->height;
+		w->pos[0]=0;
+		w->pos[1]=0;
+		if (w->flags & TDWIN_FULLSCREEN_MODE_SWITCH) {
+			glfwSetWindowMonitor(w->win, monitor, 0, 0, w->size[0], w->size[1], videoMode->refreshRate);
+		} else {
+			/* windowed fullscreen: an undecorated window covering the
+			 * monitor, which the compositor may or may not flip */
+			if (w->decorated) {
+#if GLFW_VERSION_MAJOR > 3 || (GLFW_VERSION_MAJOR == 3 && GLFW_VERSION_MINOR >= 3)
+				glfwSetWindowAttrib(w->win, GLFW_DECORATED, GLFW_FALSE);
+				w->decorated=0;
 #else
-	warn("swap control not implemented for this platform");
-	return;
+				return -1;
 #endif
-	ctx->flags |= TDCTX_SWAP_INTERVAL_SET;
-	td_ctx_set_title(ctx);
+			}
+			glfwSetWindowMonitor(w->win, NULL, 0, 0, w->size[0], w->size[1], GLFW_DONT_CARE);
+		}
+	} else {
+		if (!w->decorated) {
+#if GLFW_VERSION_MAJOR > 3 || (GLFW_VERSION_MAJOR == 3 && GLFW_VERSION_MINOR >= 3)
+			glfwSetWindowAttrib(w->win, GLFW_DECORATED, GLFW_TRUE);
+			w->decorated=1;
+#else
+			return -1;
+#endif
+		}
+		w->refresh_rate=(videoMode)?videoMode->refreshRate:0;
+		w->pos[0]=w->windowed_pos[0];
+		w->pos[1]=w->windowed_pos[1];
+		w->size[0]=w->windowed_size[0];
+		w->size[1]=w->windowed_size[1];
+		glfwSetWindowMonitor(w->win, NULL, w->pos[0], w->pos[1], w->size[0], w->size[1], GLFW_DONT_CARE);
+	}
+	glfwGetFramebufferSize(w->win, &w->size[0], &w->size[1]);
+	info(1,"switched GL window in place (%dx%d, %dHz)",w->size[0],w->size[1],w->refresh_rate);
+	return 0;
+}
+
+/* create an invisible window just for its GL context, which can then be
+ * made current on a helper thread, this must be called on the main thread */
+static GLFWwindow *
+td_win_create_hidden(GLFWwindow *share)
+{
+	GLFWwindow *win;
+
+	glfwDefaultWindowHints();
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+	glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
+	if (!(win=glfwCreateWindow(1, 1, APPTITLE, NULL, share))) {
+		warn("failed to create hidden GL context");
+		return NULL;
+	}
+	info(2,"created hidden GL context");
+	return win;
+}
+
+/* the programs, buffers and textures are created in a hidden context which
+ * lives as long as the program, every window shares its objects, so they
+ * survive recreating the window; without it, they are recreated as well */
+static void
+td_win_create_share(TDWindow *w)
+{
+	if (!(w->share=td_win_create_hidden(NULL))) {
+		warn("GL objects will be recreated with every window");
+		return;
+	}
+	glfwMakeContextCurrent(w->share);
+	if (!gladLoadGL()) {
+		warn("failed to initialize GLAD");
+		glfwMakeContextCurrent(NULL);
+		glfwDestroyWindow(w->share);
+		w->share=NULL;
+	}
+}
+
+static void
+td_win_destroy_share(TDWindow *w)
+{
+	if (w->share) {
+		glfwDestroyWindow(w->share);
+		w->share=NULL;
+	}
 }
 
 /****************************************************************************
- * EVENT HANDLING                                                           *
+ * GL HELPER                                                                *
  ****************************************************************************/
 
+/* ---------------------- program binary cache ------------------------------
+ * Linked programs are stored with glGetProgramBinary in one file per
+ * program, named after a hash of the GL vendor, renderer and version string
+ * (which contains the driver version) and of the shader sources. A file is
+ * written under a temporary name and renamed, so readers never see a partial
+ * one. If the driver rejects a binary, the program is compiled from source
+ * and the file is replaced. */
+
+#define PROGRAM_CACHE_MAGIC	0x42504454U	/* "TDPB" */
+#define PROGRAM_CACHE_SIZE_MAX	(64U*1024U*1024U)
+
+typedef struct {
+	uint32_t magic;
+	uint32_t format;
+	uint32_t length;
+	uint32_t reserved;
+	uint64_t key;
+} TDProgramCacheHeader;
+
+static TDProgramCache td_program_cache;
+
+static uint64_t
+td_hash_str(uint64_t h, const char *str)
+{
+	/* FNV-1a, including the terminating zero */
+	do {
+		h ^= (unsigned char)*str;
+		h *= 0x100000001b3ULL;
+	} while (*str++);
+	return h;
+}
+
+/* dir NULL selects the default location, an empty dir disables the cache */
 static void
-td_ctx_switch_fullscreen(TDContext *ctx, unsigned int fs_flags)
+td_program_cache_init(TDProgramCache *pc, const char *dir)
 {
-	if (ctx->win.flags & TDWIN_FULLSCREEN) {
-		info(1,"switch to windowed mode requested");
-		ctx->win.flags &= ~(TDWIN_FULLSCREEN | TDWIN_FULLSCREEN_MODE_SWITCH);
-		ctx->win.flags |= TDWIN_DECORATED;
-	} else {
-		info(1,"switch to fullscreen requested");
-		ctx->win.flags &= ~(TDWIN_DECORATED | TDWIN_FULLSCREEN_MODE_SWITCH);
-		ctx->win.flags |= TDWIN_FULLSCREEN | fs_flags;
+	const char *base;
+
+	memset(pc, 0, sizeof(*pc));
+	pc->supported=-1;
+	if (dir) {
+		my_snprintf(pc->dir, sizeof(pc->dir), "%s", dir);
+#if defined(WIN32)
+	} else if ((base=getenv("LOCALAPPDATA")) && *base) {
+		my_snprintf(pc->dir, sizeof(pc->dir), "%s\\glteardetect", base);
+#else
+	} else if ((base=getenv("XDG_CACHE_HOME")) && *base) {
+		my_snprintf(pc->dir, sizeof(pc->dir), "%s/glteardetect", base);
+	} else if ((base=getenv("HOME")) && *base) {
+		my_snprintf(pc->dir, sizeof(pc->dir), "%s/.cache/glteardetect", base);
+#endif
 	}
-	ctx->flags |= TDCTX_DROP_WINDOW;
 }
 
+static int
+td_mkdir(const char *path)
+{
+#if defined(WIN32)
+	return (_mkdir(path) && errno != EEXIST)?-1:0;
+#else
+	return (mkdir(path, 0755) && errno != EEXIST)?-1:0;
+#endif
+}
+
+/* find out whether the driver can hand out program binaries, and hash the
+ * strings which identify it, in the current context */
 static void
-td_ctx_keyhandler(GLFWwindow *win, int key, int scancode, int action, int mods)
+td_program_cache_probe(TDProgramCache *pc)
 {
-	TDContext *ctx=glfwGetWindowUserPointer(win);
+	const char *vendor,*renderer,*version;
+	GLint formats=0;
+	uint64_t h;
 
-	(void)scancode;
-	if (action == GLFW_PRESS) {
-		switch(key) {
-			case GLFW_KEY_ESCAPE:
-				ctx->flags &= ~TDCTX_RUN;
-				break;
-			case GLFW_KEY_RIGHT:
-			case GLFW_KEY_SPACE:
-				if (++ctx->mode >= TDDISP_MODE_COUNT) {
-					ctx->mode -= TDDISP_MODE_COUNT;
-				}
-				info(5,"switched to mode %u",(unsigned)ctx->mode);
-				break;
-			case GLFW_KEY_LEFT:
-			case GLFW_KEY_BACKSPACE:
-				if (ctx->mode > (TDDisplayMode)0) {
-					ctx->mode--;
-				} else {
-					ctx->mode=TDDISP_MODE_COUNT-1;
-				}
-				info(5,"switched to mode %u",(unsigned)ctx->mode);
-				break;
-			case GLFW_KEY_ENTER:
-			case 'W':
-				ctx->flags |= TDCTX_DROP_WINDOW;
-				break;
-			case GLFW_KEY_UP:
-				ctx->pulse.speed *= 2.0f;
-				ctx->bars.data[1] *= 2.0f;
-				break;
-			case GLFW_KEY_DOWN:
-				ctx->pulse.speed /= 2.0f;
-				ctx->bars.data[1] /= 2.0f;
+	if (!pc->dir[0] || pc->supported >= 0) {
+		return;
+	}
+	vendor=(const char*)glGetString(GL_VENDOR);
+	renderer=(const char*)glGetString(GL_RENDERER);
+	version=(const char*)glGetString(GL_VERSION);
+	pc->supported=0;
+	if (!GLAD_GL_VERSION_4_1 && !GLAD_GL_ARB_get_program_binary) {
+		info(2,"program cache: ARB_get_program_binary not available");
+		return;
+	}
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+	if (formats < 1 || !vendor || !renderer || !version) {
+		info(2,"program cache: no program binary formats");
+		return;
+	}
+	h=td_hash_str(0xcbf29ce484222325ULL, vendor);
+	h=td_hash_str(h, renderer);
+	pc->driver=td_hash_str(h, version);
+	pc->supported=1;
+	info(2,"program cache: %s", pc->dir);
+}
+
+/* the key of the program, 0 if the cache can't be used */
+static uint64_t
+td_program_cache_key(const TDProgramCache *pc, const GLchar *vs, const GLchar *fs)
+{
+	uint64_t h;
+
+	if (!pc || !pc->dir[0] || pc->supported <= 0) {
+		return 0;
+	}
+	h=td_hash_str(pc->driver, vs);
+	return td_hash_str(h, fs) | 1;
+}
+
+static void
+td_program_cache_path(const TDProgramCache *pc, uint64_t key, char *path, size_t size)
+{
+	my_snprintf(path, size, "%s/%016llx.bin", pc->dir, (unsigned long long)key);
+}
+
+/* returns the program, or 0 if it is not in the cache or was rejected */
+static GLuint
+td_program_cache_load(TDProgramCache *pc, uint64_t key)
+{
+	TDProgramCacheHeader hdr;
+	char path[PROGRAM_CACHE_PATH_MAX+32];
+	void *blob;
+	GLint status=GL_FALSE;
+	GLuint prog;
+	FILE *f;
+
+	td_program_cache_path(pc, key, path, sizeof(path));
+	if (!(f=fopen(path, "rb"))) {
+		pc->misses++;
+		return 0;
+	}
+	if (fread(&hdr, sizeof(hdr), 1, f) != 1 || hdr.magic != PROGRAM_CACHE_MAGIC || hdr.key != key ||
+	    !hdr.length || hdr.length > PROGRAM_CACHE_SIZE_MAX || !(blob=malloc(hdr.length))) {
+		fclose(f);
+		pc->rejected++;
+		return 0;
+	}
+	if (fread(blob, hdr.length, 1, f) != 1) {
+		free(blob);
+		fclose(f);
+		pc->rejected++;
+		return 0;
+	}
+	fclose(f);
+	prog=glCreateProgram();
+	glProgramBinary(prog, (GLenum)hdr.format, blob, (GLsizei)hdr.length);
+	free(blob);
+	glGetProgramiv(prog, GL_LINK_STATUS, &status);
+	if (status != GL_TRUE) {
+		info(2,"program cache: binary %016llx rejected, recompiling", (unsigned long long)key);
+		glDeleteProgram(prog);
+		pc->rejected++;
+		return 0;
+	}
+	pc->hits++;
+	return prog;
+}
+
+static void
+td_program_cache_store(TDProgramCache *pc, uint64_t key, GLuint prog)
+{
+	TDProgramCacheHeader hdr;
+	char path[PROGRAM_CACHE_PATH_MAX+32],tmp[PROGRAM_CACHE_PATH_MAX+48];
+	GLint length=0;
+	GLsizei written=0;
+	GLenum format=0;
+	void *blob;
+	char *sep;
+	FILE *f;
+	int err;
+
+	glGetProgramiv(prog, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length < 1 || !(blob=malloc((size_t)length))) {
+		pc->failed++;
+		return;
+	}
+	glGetProgramBinary(prog, length, &written, &format, blob);
+	if (written < 1) {
+		free(blob);
+		pc->failed++;
+		return;
+	}
+	hdr.magic=PROGRAM_CACHE_MAGIC;
+	hdr.format=(uint32_t)format;
+	hdr.length=(uint32_t)written;
+	hdr.reserved=0;
+	hdr.key=key;
+
+	/* the parent directory too, for the default location */
+	td_program_cache_path(pc, key, path, sizeof(path));
+	my_snprintf(tmp, sizeof(tmp), "%s", pc->dir);
+	sep=tmp + strlen(tmp);
+	while (sep > tmp && sep[-1] != '/' && sep[-1] != '\\') {
+		sep--;
+	}
+	if (sep > tmp + 1) {
+		sep[-1]=0;
+		td_mkdir(tmp);
+	}
+	td_mkdir(pc->dir);
+#if defined(WIN32)
+	my_snprintf(tmp, sizeof(tmp), "%s.%d.tmp", path, _getpid());
+#else
+	my_snprintf(tmp, sizeof(tmp), "%s.%d.tmp", path, (int)getpid());
+#endif
+	if (!(f=fopen(tmp, "wb"))) {
+		if (!pc->failed++) {
+			warn("program cache: can't write to '%s'", pc->dir);
+		}
+		free(blob);
+		return;
+	}
+	err=(fwrite(&hdr, sizeof(hdr), 1, f) != 1);
+	err |= (fwrite(blob, (size_t)written, 1, f) != 1);
+	err |= fclose(f);
+	free(blob);
+#if defined(WIN32)
+	err=err || !MoveFileExA(tmp, path, MOVEFILE_REPLACE_EXISTING);
+#else
+	err=err || rename(tmp, path);
+#endif
+	if (err) {
+		remove(tmp);
+		if (!pc->failed++) {
+			warn("program cache: failed to write '%s'", path);
+		}
+		return;
+	}
+	pc->stored++;
+}
+
+/* --------------------------- compiling -----------------------------------*/
+
+static GLuint make_shader(const GLchar *src, GLenum type)
+{
+	GLint status=GL_FALSE;
+	GLuint sh=glCreateShader(type);
+	if (sh) {
+		glShaderSource(sh, 1, &src, NULL);
+		glCompileShader(sh);
+		glGetShaderiv(sh, GL_COMPILE_STATUS, &status);
+		if (status != GL_TRUE) {
+			GLchar buf[8192];
+			glGetShaderInfoLog(sh, sizeof(buf), NULL, buf);
+			warn("shader compilation failed: %s", buf);
+		}
+	}
+	return sh;
+}
+
+/* pc NULL bypasses the cache, which is not locked, so only the main thread
+ * may use it */
+static GLuint make_program_cached(TDProgramCache *pc, const GLchar *vs, const GLchar *fs)
+{
+	uint64_t t0=get_current_time();
+	uint64_t key=td_program_cache_key(pc, vs, fs);
+	GLuint sh_vs, sh_fs, prog;
+	GLint status=GL_FALSE;
+
+	if (key && (prog=td_program_cache_load(pc, key))) {
+		pc->time += get_current_time() - t0;
+		return prog;
+	}
+	sh_vs=make_shader(vs, GL_VERTEX_SHADER);
+	sh_fs=make_shader(fs, GL_FRAGMENT_SHADER);
+	prog=glCreateProgram();
+	if (key) {
+		glProgramParameteri(prog, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	}
+	glAttachShader(prog, sh_vs);
+	glAttachShader(prog, sh_fs);
+	glLinkProgram(prog);
+	glGetProgramiv(prog, GL_LINK_STATUS, &status);
+	if (status != GL_TRUE) {
+		GLchar buf[8192];
+		glGetProgramInfoLog(prog, sizeof(buf), NULL, buf);
+		warn("program link failed: %s",buf);
+
+	} else {
+		info(5,"program %u linked successfully", prog);
+		if (key) {
+			td_program_cache_store(pc, key, prog);
+		}
+	}
+	glDetachShader(prog, sh_fs);
+	glDetachShader(prog, sh_vs);
+	glDeleteShader(sh_vs);
+	glDeleteShader(sh_fs);
+	if (pc) {
+		pc->time += get_current_time() - t0;
+	}
+	return prog;
+}
+
+static GLuint make_program(const GLchar *vs, const GLchar *fs)
+{
+	return make_program_cached(&td_program_cache, vs, fs);
+}
+
+/****************************************************************************
+ * TIMER QUERY RING                                                         *
+ * Queries are issued at the head and harvested in order from the tail,     *
+ * but only once GL_QUERY_RESULT_AVAILABLE says so, so we never stall the   *
+ * render thread waiting for the GPU. If the ring runs full, it is grown up *
+ * to TIMER_QUERY_MAX entries, after that the oldest pending query is       *
+ * recycled and its frame is counted as dropped.                            *
+ ****************************************************************************/
+
+static void
+td_query_ring_init(TDQueryRing *ring)
+{
+	ring->slot=NULL;
+	ring->size=0;
+	ring->head=0;
+	ring->count=0;
+	ring->dropped=0;
+}
+
+static int
+td_query_ring_alloc(TDQueryRing *ring, unsigned int size)
+{
+	TDQuerySlot *slot;
+	unsigned int tail=(ring->head + ring->size - ring->count);
+	unsigned int i;
+
+	slot=malloc(size * sizeof(*slot));
+	if (!slot) {
+		warn("failed to allocate %u timer query slots", size);
+		return -1;
+	}
+	/* keep the pending queries in order at the start of the new ring,
+	 * followed by the idle ones, and create new query objects for the rest */
+	for (i=0; i<ring->size; i++) {
+		slot[i]=ring->slot[(tail + i) % ring->size];
+	}
+	for (; i<size; i++) {
+		glGenQueries(TDPROBE_COUNT, slot[i].query);
+		slot[i].timestamp=0;
+	}
+	free(ring->slot);
+	ring->slot=slot;
+	ring->head=ring->count;
+	ring->size=size;
+	return 0;
+}
+
+static void
+td_query_ring_gl_init(TDQueryRing *ring)
+{
+	td_query_ring_init(ring);
+	td_query_ring_alloc(ring, TIMER_QUERY_COUNT);
+}
+
+static void
+td_query_ring_gl_destroy(TDQueryRing *ring)
+{
+	unsigned int i;
+
+	for (i=0; i<ring->size; i++) {
+		glDeleteQueries(TDPROBE_COUNT, ring->slot[i].query);
+	}
+	free(ring->slot);
+	ring->slot=NULL;
+	ring->size=0;
+	ring->head=0;
+	ring->count=0;
+}
+
+/* get the slot for a new frame, the caller must issue all probes on it,
+ * if a pending slot had to be recycled, a copy of it is returned in lost */
+static TDQuerySlot *
+td_query_ring_issue(TDQueryRing *ring, TDQuerySlot **lost)
+{
+	TDQuerySlot *slot;
+
+	*lost=NULL;
+	if (ring->count >= ring->size) {
+		if (ring->size >= TIMER_QUERY_MAX || td_query_ring_alloc(ring, 2*ring->size)) {
+			/* recycle the oldest pending query, its result is lost */
+			ring->lost=ring->slot[ring->head];
+			*lost=&ring->lost;
+			ring->count--;
+			ring->dropped++;
+		} else {
+			info(2,"timer query results are late, grew query ring to %u", ring->size);
+		}
+	}
+	slot=&ring->slot[ring->head];
+	ring->head=(ring->head + 1) % ring->size;
+	ring->count++;
+	return slot;
+}
+
+/* get the i-th pending slot, counting from the oldest one */
+static TDQuerySlot *
+td_query_ring_pending(TDQueryRing *ring, unsigned int i)
+{
+	if (i >= ring->count) {
+		return NULL;
+	}
+	return &ring->slot[(ring->head + ring->size - ring->count + i) % ring->size];
+}
+
+/* fetch the results of the oldest pending slot into its record, if they
+ * are all available or wait is set, returns 1 if a slot was harvested and
+ * 0 otherwise */
+static int
+td_query_ring_harvest(TDQueryRing *ring, TDQuerySlot **slot, int wait)
+{
+	TDQuerySlot *s;
+	GLint available=0;
+	int i;
+
+	if (!ring->count) {
+		return 0;
+	}
+	s=td_query_ring_pending(ring, 0);
+	for (i=TDPROBE_COUNT-1; i>=0 && !wait; i--) {
+		glGetQueryObjectiv(s->query[i], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available) {
+			return 0;
+		}
+	}
+	for (i=0; i<TDPROBE_COUNT; i++) {
+		GLuint64 result;
+		glGetQueryObjectui64v(s->query[i], GL_QUERY_RESULT, &result);
+		s->rec.gpu[i]=result;
+	}
+	ring->count--;
+	*slot=s;
+	return 1;
+}
+
+/****************************************************************************
+ * PRESENT TIMING                                                           *
+ * With the X Present extension, GLX_OML_sync_control or                   *
+ * GLX_INTEL_swap_event, the window system tells us the UST                 *
+ * (CLOCK_MONOTONIC microseconds on Linux), MSC (vblank counter) and SBC    *
+ * (swap counter) of every completed swap. Each swap gets its SBC when it   *
+ * is issued, and the results are matched to the frames still pending in   *
+ * the timer query ring. Without any of these, only the timer queries are  *
+ * used.                                                                    *
+ ****************************************************************************/
+
+static const char *td_present_name[TDPRESENT_COUNT]={
+	"auto",
+	"query",
+#if defined(LINUX)
+	"oml",
+	"intel",
+#if defined(HAVE_XCB_PRESENT)
+	"xpresent"
+#endif
+#endif
+};
+
+static void
+td_present_init(TDPresent *p)
+{
+	memset(p, 0, sizeof(*p));
+	p->requested=TDPRESENT_AUTO;
+	p->mode=TDPRESENT_QUERY;
+	p->used=TDPRESENT_QUERY;
+}
+
+#if defined(LINUX)
+/* anchor our swap count to the server SBC of the drawable, so that lost or
+ * foreign completion events don't shift the later ones; a new drawable
+ * starts at 0 */
+static void
+td_present_anchor(TDPresent *p)
+{
+	int64_t ust,msc,sbc;
+
+	p->sbc_offset=-p->sbc_issued;
+	if (GLAD_GLX_OML_sync_control && glXGetSyncValuesOML(p->dpy, p->drawable, &ust, &msc, &sbc)) {
+		p->sbc_offset=sbc - p->sbc_issued;
+	}
+}
+
+/* try to set up one backend, returns 0 on success */
+static int
+td_present_start_mode(TDPresent *p, TDPresentMode mode)
+{
+	int64_t ust,msc,sbc;
+	int error_base;
+
+	switch (mode) {
+		case TDPRESENT_OML:
+			if (!GLAD_GLX_OML_sync_control) {
+				return -1;
+			}
+			if (!glXGetSyncValuesOML(p->dpy, p->drawable, &ust, &msc, &sbc)) {
+				warn("glXGetSyncValuesOML failed");
+				return -1;
+			}
+			p->sbc_offset=sbc - p->sbc_issued;
+			return 0;
+		case TDPRESENT_INTEL:
+			if (!GLAD_GLX_INTEL_swap_event) {
+				return -1;
+			}
+			if (!glXQueryExtension(p->dpy, &error_base, &p->event_base)) {
+				warn("failed to query the GLX event base");
+				return -1;
+			}
+			td_present_anchor(p);
+			glXSelectEvent(p->dpy, p->drawable, GLX_BUFFER_SWAP_COMPLETE_INTEL_MASK);
+			return 0;
+#if defined(HAVE_XCB_PRESENT)
+		case TDPRESENT_XPRESENT:
+			{
+				xcb_present_query_version_reply_t *reply;
+				xcb_generic_error_t *err=NULL;
+
+				p->conn=XGetXCBConnection(p->dpy);
+				reply=xcb_present_query_version_reply(p->conn,
+					xcb_present_query_version(p->conn, 1, 0), NULL);
+				if (!reply) {
+					return -1;
+				}
+				free(reply);
+				/* our own event id, delivered to a special queue so that
+				 * neither GLFW nor the GL driver see these events */
+				p->eid=xcb_generate_id(p->conn);
+				err=xcb_request_check(p->conn, xcb_present_select_input_checked(p->conn,
+					p->eid, (xcb_window_t)p->window, XCB_PRESENT_EVENT_MASK_COMPLETE_NOTIFY));
+				if (err) {
+					warn("failed to select X Present events");
+					free(err);
+					return -1;
+				}
+				p->special=xcb_register_for_special_xge(p->conn, &xcb_present_id, p->eid, NULL);
+				if (!p->special) {
+					xcb_present_select_input(p->conn, p->eid, (xcb_window_t)p->window, 0);
+					return -1;
+				}
+				/* the GL driver passes its swap count of the drawable
+				 * as the serial of every PresentPixmap */
+				td_present_anchor(p);
+			}
+			return 0;
+#endif
+		default:
+			return -1;
+	}
+}
+
+static void
+td_present_stop_mode(TDPresent *p)
+{
+	switch (p->mode) {
+		case TDPRESENT_INTEL:
+			glXSelectEvent(p->dpy, p->drawable, 0);
+			break;
+#if defined(HAVE_XCB_PRESENT)
+		case TDPRESENT_XPRESENT:
+			xcb_present_select_input(p->conn, p->eid, (xcb_window_t)p->window, 0);
+			xcb_unregister_for_special_event(p->conn, p->special);
+			xcb_flush(p->conn);
+			p->special=NULL;
+			break;
+#endif
+		default:
+			(void)0;
+	}
+	p->mode=TDPRESENT_QUERY;
+}
+#endif
+
+/* select the backend for the current window, the binding extensions must
+ * already be loaded */
+static void
+td_present_start(TDPresent *p, GLFWwindow *win)
+{
+	TDPresentMode mode=p->requested;
+
+	p->mode=TDPRESENT_QUERY;
+	p->sbc_issued=0;
+	p->sbc_done=0;
+#if defined(LINUX)
+	p->dpy=glfwGetX11Display();
+	p->window=glfwGetX11Window(win);
+	/* the context is current on the window */
+	if ((p->drawable=glXGetCurrentDrawable()) == None) {
+		warn("failed to get current GLX drawable!");
+		p->drawable=p->window;
+	}
+	if (mode == TDPRESENT_AUTO) {
+		/* prefer the backends which tell us the most */
+		static const TDPresentMode order[]={
+#if defined(HAVE_XCB_PRESENT)
+			TDPRESENT_XPRESENT,
+#endif
+			TDPRESENT_OML,
+			TDPRESENT_INTEL
+		};
+		unsigned int i;
+
+		mode=TDPRESENT_QUERY;
+		for (i=0; i<sizeof(order)/sizeof(order[0]); i++) {
+			if (!td_present_start_mode(p, order[i])) {
+				mode=order[i];
+				break;
+			}
+		}
+	} else if (mode != TDPRESENT_QUERY && td_present_start_mode(p, mode)) {
+		warn("present timing backend %s not available", td_present_name[mode]);
+		mode=TDPRESENT_QUERY;
+	}
+#else
+	(void)win;
+	if (mode != TDPRESENT_AUTO && mode != TDPRESENT_QUERY) {
+		warn("present timing backend %s not available", td_present_name[mode]);
+	}
+	mode=TDPRESENT_QUERY;
+#endif
+	p->mode=mode;
+	p->used=mode;
+	info(1,"present timing: %s", td_present_name[mode]);
+}
+
+static void
+td_present_stop(TDPresent *p)
+{
+#if defined(LINUX)
+	td_present_stop_mode(p);
+#endif
+	p->mode=TDPRESENT_QUERY;
+}
+
+/* called directly after SwapBuffers */
+static void
+td_present_swap(TDPresent *p, TDFrameRecord *rec)
+{
+	rec->t_present=0;
+	rec->msc=0;
+	rec->sbc=0;
+	rec->complete=TDCOMPLETE_UNKNOWN;
+	if (p->mode != TDPRESENT_QUERY) {
+		rec->sbc=++p->sbc_issued;
+	}
+}
+
+#if defined(LINUX)
+/* attach the completion values of swap sbc (our own count) to its frame */
+static void
+td_present_complete(TDPresent *p, TDQueryRing *ring, int64_t ust, int64_t msc, int64_t sbc,
+		TDCompleteMode complete)
+{
+	TDQuerySlot *slot;
+	unsigned int i;
+
+	for (i=0; (slot=td_query_ring_pending(ring, i)); i++) {
+		if (slot->rec.sbc == sbc) {
+			slot->rec.t_present=(uint64_t)ust * 1000;
+			slot->rec.msc=msc;
+			slot->rec.complete=complete;
+			p->presented++;
+			break;
+		}
+	}
+	if (sbc > p->sbc_done) {
+		p->sbc_done=sbc;
+	}
+}
+
+#if defined(HAVE_XCB_PRESENT)
+static void
+td_present_poll_xpresent(TDPresent *p, TDQueryRing *ring)
+{
+	xcb_generic_event_t *ev;
+
+	while ((ev=xcb_poll_for_special_event(p->conn, p->special))) {
+		const xcb_present_generic_event_t *ge=(const xcb_present_generic_event_t*)ev;
+		if (ge->evtype == XCB_PRESENT_COMPLETE_NOTIFY) {
+			const xcb_present_complete_notify_event_t *ce=(const xcb_present_complete_notify_event_t*)ev;
+			if (ce->kind == XCB_PRESENT_COMPLETE_KIND_PIXMAP) {
+				TDCompleteMode complete=TDCOMPLETE_UNKNOWN;
+				int64_t sbc;
+				switch (ce->mode) {
+					case XCB_PRESENT_COMPLETE_MODE_COPY:
+						complete=TDCOMPLETE_COPY;
+						break;
+					case XCB_PRESENT_COMPLETE_MODE_FLIP:
+						complete=TDCOMPLETE_FLIP;
+						break;
+					case XCB_PRESENT_COMPLETE_MODE_SKIP:
+						complete=TDCOMPLETE_SKIP;
+						break;
+					case XCB_PRESENT_COMPLETE_MODE_SUBOPTIMAL_COPY:
+						complete=TDCOMPLETE_SUBOPTIMAL_COPY;
+						break;
+				}
+				/* the serial is the low 32 bits of the server SBC */
+				sbc=p->sbc_issued + (int32_t)(ce->serial -
+					(uint32_t)(p->sbc_offset + p->sbc_issued));
+				/* presentations from before we selected the events or
+				 * not from our context are ignored, frames whose event is
+				 * missing are given up once a later one completed */
+				if (sbc > p->sbc_done && sbc <= p->sbc_issued) {
+					td_present_complete(p, ring, (int64_t)ce->ust, (int64_t)ce->msc,
+						sbc, complete);
+				}
+			}
+		}
+		free(ev);
+	}
+	if (!p->sbc_done && p->sbc_issued > PRESENT_PROBE_FRAMES) {
+		/* the GL driver doesn't use Present for this window (e.g. no DRI3),
+		 * fall back to OML, which can keep the anchor from the start, if
+		 * it works for the drawable, and to timer queries otherwise */
+		int64_t ust,msc,sbc;
+
+		warn("no X Present events received, falling back");
+		td_present_stop_mode(p);
+		p->sbc_done=p->sbc_issued;
+		if (GLAD_GLX_OML_sync_control && glXGetSyncValuesOML(p->dpy, p->drawable, &ust, &msc, &sbc)) {
+			p->mode=TDPRESENT_OML;
+		}
+		p->used=p->mode;
+		info(1,"present timing: %s", td_present_name[p->mode]);
+	}
+}
+#endif
+#endif
+
+/* collect the completed swaps, never blocks */
+static void
+td_present_poll(TDPresent *p, TDQueryRing *ring)
+{
+#if defined(LINUX)
+	int64_t ust,msc,sbc;
+
+	if (p->mode == TDPRESENT_OML) {
+		if (!glXGetSyncValuesOML(p->dpy, p->drawable, &ust, &msc, &sbc)) {
+			return;
+		}
+		if (sbc - p->sbc_offset > p->sbc_done) {
+			/* that swap is already complete, so this returns immediately
+			 * with its values; swaps completed in between are given up */
+			if (glXWaitForSbcOML(p->dpy, p->drawable, sbc, &ust, &msc, &sbc)) {
+				td_present_complete(p, ring, ust, msc, sbc - p->sbc_offset,
+					TDCOMPLETE_UNKNOWN);
+			}
+		}
+	} else if (p->mode == TDPRESENT_INTEL) {
+		XEvent ev;
+		while (XCheckTypedWindowEvent(p->dpy, p->drawable,
+				p->event_base + GLX_BufferSwapComplete, &ev)) {
+			const GLXBufferSwapComplete *sc=(const GLXBufferSwapComplete*)&ev;
+			if (sc->sbc - p->sbc_offset > p->sbc_issued || sc->sbc - p->sbc_offset < 1) {
+				/* not one of our swaps, the anchor is wrong: rather give
+				 * up than attach the values to the wrong frames */
+				warn("GLX swap event for unexpected SBC %lld, falling back",
+					(long long)sc->sbc);
+				td_present_stop_mode(p);
+				p->sbc_done=p->sbc_issued;
+				p->used=p->mode;
+				info(1,"present timing: %s", td_present_name[p->mode]);
+				return;
+			}
+			td_present_complete(p, ring, sc->ust, sc->msc, sc->sbc - p->sbc_offset,
+				/* an exchange swaps the buffers without a copy, like a flip */
+				(sc->event_type != GLX_COPY_COMPLETE_INTEL)?TDCOMPLETE_FLIP:
+				TDCOMPLETE_COPY);
+		}
+	}
+#if defined(HAVE_XCB_PRESENT)
+	else if (p->mode == TDPRESENT_XPRESENT) {
+		td_present_poll_xpresent(p, ring);
+	}
+#endif
+#else
+	(void)p;
+	(void)ring;
+#endif
+}
+
+/* returns 1 if the frame still waits for its present time */
+static int
+td_present_pending(TDPresent *p, const TDFrameRecord *rec, unsigned int frame)
+{
+	if (!rec->sbc || rec->t_present || rec->sbc <= p->sbc_done) {
+		return 0;
+	}
+	if (frame - rec->frame < PRESENT_TIMEOUT_FRAMES) {
+		return 1;
+	}
+	return 0;
+}
+
+/****************************************************************************
+ * CLOCK CALIBRATION                                                        *
+ * A helper thread with its own hidden GL context samples GL_TIMESTAMP      *
+ * against CLOCK_MONOTONIC a few times per second and fits offset and drift *
+ * with a Theil-Sen estimator (median of the pairwise slopes), so that the  *
+ * render thread can convert between both clocks without a GL round trip.   *
+ ****************************************************************************/
+
+static void
+td_clock_init(TDClockCalib *c)
+{
+	c->enabled=1;
+	c->active=0;
+	c->win=NULL;
+	c->run=0;
+	c->seq=0;
+	memset(&c->model, 0, sizeof(c->model));
+	c->count=0;
+	c->next=0;
+}
+
+/* get a consistent copy of the current model, returns 0 if it is valid;
+ * the last model stays available after td_clock_stop for the report */
+static int
+td_clock_get_model(const TDClockCalib *c, TDClockModel *model)
+{
+	unsigned int seq;
+
+	do {
+		seq=td_atomic_load(&c->seq);
+		*model=c->model;
+		td_atomic_fence();
+	} while ((seq & 1) || seq != td_atomic_load(&c->seq));
+	return (model->samples >= CLOCK_CALIB_MIN_SAMPLES)?0:-1;
+}
+
+static void
+td_clock_set_model(TDClockCalib *c, const TDClockModel *model)
+{
+	unsigned int seq=c->seq;
+
+	td_atomic_store(&c->seq, seq+1);
+	td_atomic_fence();
+	c->model=*model;
+	td_atomic_store(&c->seq, seq+2);
+}
+
+static uint64_t
+td_clock_cpu_to_gl(const TDClockModel *m, uint64_t cpu)
+{
+	double x=(double)(int64_t)(cpu - m->cpu_ref);
+	return m->gl_ref + (uint64_t)(int64_t)floor(x * (1.0 + m->drift) + m->offset + 0.5);
+}
+
+static int
+td_clock_cmp_double(const void *a, const void *b)
+{
+	double da=*(const double*)a;
+	double db=*(const double*)b;
+	return (da < db)?-1:((da > db)?1:0);
+}
+
+static double
+td_clock_median(double *val, unsigned int n)
+{
+	qsort(val, n, sizeof(*val), td_clock_cmp_double);
+	return (n & 1)?val[n/2]:0.5*(val[n/2-1] + val[n/2]);
+}
+
+/* fit the model relative to the newest sample */
+static void
+td_clock_fit(TDClockCalib *c, TDClockModel *m)
+{
+	static double slope[CLOCK_CALIB_SAMPLES * (CLOCK_CALIB_SAMPLES-1) / 2];
+	double x[CLOCK_CALIB_SAMPLES], y[CLOCK_CALIB_SAMPLES], r[CLOCK_CALIB_SAMPLES];
+	const TDClockSample *ref=&c->sample[(c->next + CLOCK_CALIB_SAMPLES - 1) % CLOCK_CALIB_SAMPLES];
+	unsigned int i,j,n=0;
+	double sq=0.0;
+
+	for (i=0; i<c->count; i++) {
+		const TDClockSample *smp=&c->sample[i];
+		x[i]=(double)(int64_t)(smp->cpu - ref->cpu);
+		y[i]=(double)(int64_t)(smp->gl - ref->gl) - x[i];
+	}
+	for (i=0; i<c->count; i++) {
+		for (j=i+1; j<c->count; j++) {
+			if (x[j] != x[i]) {
+				slope[n++]=(y[j] - y[i]) / (x[j] - x[i]);
+			}
+		}
+	}
+	m->cpu_ref=ref->cpu;
+	m->gl_ref=ref->gl;
+	m->drift=(n)?td_clock_median(slope, n):0.0;
+	for (i=0; i<c->count; i++) {
+		r[i]=y[i] - m->drift * x[i];
+	}
+	m->offset=td_clock_median(r, c->count);
+	for (i=0; i<c->count; i++) {
+		double d=y[i] - m->drift * x[i] - m->offset;
+		sq += d*d;
+	}
+	m->rms=sqrt(sq / (double)c->count);
+	m->samples=c->count;
+}
+
+/* take the sample with the shortest round trip out of a few tries */
+static void
+td_clock_sample(TDClockSample *smp)
+{
+	int i;
+
+	smp->width=~0ULL;
+	for (i=0; i<3; i++) {
+		uint64_t t0,t1;
+		GLint64 gl;
+		t0=get_current_time();
+		glGetInteger64v(GL_TIMESTAMP, &gl);
+		t1=get_current_time();
+		if (t1 - t0 < smp->width) {
+			smp->cpu=t0 + (t1 - t0)/2;
+			smp->gl=(uint64_t)gl;
+			smp->width=t1 - t0;
+		}
+	}
+}
+
+TD_THREAD_FUNC(td_clock_thread, arg)
+{
+	TDClockCalib *c=arg;
+
+	glfwMakeContextCurrent(c->win);
+	while (td_atomic_load(&c->run)) {
+		TDClockModel model;
+		uint64_t t_next=get_current_time() + CLOCK_CALIB_INTERVAL_NS;
+
+		td_clock_sample(&c->sample[c->next]);
+		c->next=(c->next + 1) % CLOCK_CALIB_SAMPLES;
+		if (c->count < CLOCK_CALIB_SAMPLES) {
+			c->count++;
+		}
+		td_clock_fit(c, &model);
+		td_clock_set_model(c, &model);
+		while (td_atomic_load(&c->run) && get_current_time() < t_next) {
+			sleep_nanoseconds(10000000);
+		}
+	}
+	glfwMakeContextCurrent(NULL);
+	TD_THREAD_RETURN;
+}
+
+/* needs the GL functions to be loaded already */
+static void
+td_clock_start(TDClockCalib *c)
+{
+	if (!c->enabled || c->active) {
+		return;
+	}
+	if (!(c->win=td_win_create_hidden(NULL))) {
+		warn("clock calibration disabled");
+		c->enabled=0;
+		return;
+	}
+	c->run=1;
+	if (td_thread_create(&c->thread, td_clock_thread, c)) {
+		warn("failed to create clock calibration thread");
+		glfwDestroyWindow(c->win);
+		c->win=NULL;
+		c->enabled=0;
+		return;
+	}
+	c->active=1;
+	info(2,"started clock calibration thread");
+}
+
+static void
+td_clock_stop(TDClockCalib *c)
+{
+	if (!c->active) {
+		return;
+	}
+	td_atomic_store(&c->run, 0);
+	td_thread_join(c->thread);
+	glfwDestroyWindow(c->win);
+	c->win=NULL;
+	c->active=0;
+}
+
+/****************************************************************************
+ * REFRESH ESTIMATOR                                                        *
+ ****************************************************************************/
+
+static void
+td_refresh_init(TDRefreshEst *r, int refresh_rate)
+{
+	memset(r, 0, sizeof(*r));
+	r->nominal=(refresh_rate > 0)?(1000000000.0/refresh_rate):0.0;
+	r->state=TDREFRESH_EMPTY;
+}
+
+static void
+td_refresh_restart(TDRefreshEst *r, uint64_t t, double period)
+{
+	r->t_base=t;
+	r->phase=0.0;
+	r->period=period;
+	/* phase is known up to the wakeup jitter, the period only roughly */
+	r->P[0][0]=1.0e10;
+	r->P[0][1]=r->P[1][0]=0.0;
+	r->P[1][1]=(period * 0.01) * (period * 0.01);
+	r->R=1.0e8;
+	r->vblanks=1.0;
+	r->updates=0;
+	r->outliers_seq=0;
+	r->state=TDREFRESH_TRACKING;
+}
+
+/* feed the return time of a SwapBuffers call, this is O(1) per frame */
+static void
+td_refresh_update(TDRefreshEst *r, uint64_t t)
+{
+	double x,n,pred,res,S,K0,K1,P00,P01,P11;
+
+	switch (r->state) {
+		case TDREFRESH_EMPTY:
+			r->t_base=t;
+			r->state=TDREFRESH_FIRST;
+			return;
+		case TDREFRESH_FIRST:
+			x=(double)(int64_t)(t - r->t_base);
+			if (r->nominal > 0.0) {
+				td_refresh_restart(r, t, r->nominal);
+			} else if (x > 1000000.0) {
+				/* without a video mode, start from the first frame time */
+				td_refresh_restart(r, t, x);
+			} else {
+				r->t_base=t;
+			}
+			return;
+	}
+
+	x=(double)(int64_t)(t - r->t_base);
+	n=floor((x - r->phase) / r->period + 0.5);
+	if (n < 1.0) {
+		/* returned within the same refresh: not synchronized to vblank */
+		r->outliers++;
+		if (++r->outliers_seq >= REFRESH_MAX_OUTLIERS) {
+			td_refresh_restart(r, t, r->period);
+		}
+		return;
+	}
+
+	/* predict: the phase advances by n periods, both drift a little */
+	P00=r->P[0][0] + 2.0*n*r->P[0][1] + n*n*r->P[1][1] + n*1.0e6;
+	P01=r->P[0][1] + n*r->P[1][1];
+	P11=r->P[1][1] + n*1.0;
+	pred=r->phase + n*r->period;
+	res=x - pred;
+	S=P00 + r->R;
+
+	/* reject late wakeups and missed frames which do not fit at all */
+	if (res*res > 16.0*S && r->updates >= REFRESH_LOCK_UPDATES) {
+		r->outliers++;
+		if (++r->outliers_seq >= REFRESH_MAX_OUTLIERS) {
+			td_refresh_restart(r, t, r->period);
+		}
+		return;
+	}
+	r->outliers_seq=0;
+
+	K0=P00/S;
+	K1=P01/S;
+	r->phase=pred + K0*res;
+	r->period += K1*res;
+	r->P[0][0]=(1.0-K0)*P00;
+	r->P[0][1]=r->P[1][0]=(1.0-K0)*P01;
+	r->P[1][1]=P11 - K1*P01;
+	/* the measurement noise is the jitter of the swap return times */
+	r->R=0.95*r->R + 0.05*res*res;
+	if (r->R < 1.0e6) {
+		r->R=1.0e6;
+	}
+	r->vblanks=0.95*r->vblanks + 0.05*n;
+	r->updates++;
+
+	/* keep the doubles small */
+	if (r->phase > 1.0e12) {
+		uint64_t shift=(uint64_t)r->phase;
+		r->t_base += shift;
+		r->phase -= (double)shift;
+	}
+}
+
+/* returns 1 if the estimate can be trusted */
+static int
+td_refresh_locked(const TDRefreshEst *r)
+{
+	return (r->state == TDREFRESH_TRACKING && r->updates >= REFRESH_LOCK_UPDATES);
+}
+
+/* the estimated period differs from the one reported by the video mode */
+static int
+td_refresh_mismatch(const TDRefreshEst *r)
+{
+	double d;
+
+	if (!td_refresh_locked(r) || r->nominal <= 0.0) {
+		return 0;
+	}
+	d=fabs(r->period - r->nominal);
+	return (d > REFRESH_MISMATCH * r->nominal && d > 3.0*sqrt(r->P[1][1]));
+}
+
+/* frames are presented less often than the swap interval asks for,
+ * e.g. by a compositor */
+static int
+td_refresh_throttled(const TDRefreshEst *r, int interval)
+{
+	if (!td_refresh_locked(r) || interval < 1) {
+		return 0;
+	}
+	return (r->vblanks > 1.5 * interval);
+}
+
+/* time of the last estimated vblank in the CLOCK_MONOTONIC domain */
+static uint64_t
+td_refresh_phase(const TDRefreshEst *r)
+{
+	return r->t_base + (uint64_t)(int64_t)floor(r->phase + 0.5);
+}
+
+static void
+td_refresh_format(const TDRefreshEst *r, int interval, char *buf, size_t size)
+{
+	if (!td_refresh_locked(r)) {
+		my_snprintf(buf, size, "refresh: --Hz (%.0fHz)",
+			(r->nominal > 0.0)?(1000000000.0/r->nominal):0.0);
+		return;
+	}
+	my_snprintf(buf, size, "refresh: %.3fHz (%.0fHz)%s%s",
+		1000000000.0/r->period,
+		(r->nominal > 0.0)?(1000000000.0/r->nominal):0.0,
+		td_refresh_mismatch(r)?" MISMATCH":"",
+		td_refresh_throttled(r, interval)?" THROTTLED":"");
+}
+
+/****************************************************************************
+ * VBLANK THREAD                                                            *
+ * An optional helper thread blocks in glXWaitVideoSyncSGI and timestamps   *
+ * every vblank into a lock-free ring, independent of the render thread.   *
+ * Its context is made current on the main window, since the window system *
+ * may use a fake clock for unmapped windows such as the hidden one.       *
+ ****************************************************************************/
+
+static void
+td_vblank_init(TDVblankThread *v)
+{
+	memset(v, 0, sizeof(*v));
+	v->enabled=0;
+}
+
+#if defined(LINUX)
+TD_THREAD_FUNC(td_vblank_thread, arg)
+{
+	TDVblankThread *v=arg;
+	TDVblank vb;
+	unsigned int count=0;
+
+	if (!glXMakeCurrent(v->dpy, v->drawable, glfwGetGLXContext(v->win))) {
+		warn("vblank thread: using the hidden window, vblanks may be synthetic");
+		glfwMakeContextCurrent(v->win);
+	}
+	glXGetVideoSyncSGI(&count);
+	while (td_atomic_load(&v->run)) {
+		/* wait for the counter to change, i.e. the next vblank */
+		if (glXWaitVideoSyncSGI(2, (int)((count + 1) & 1), &count)) {
+			warn("glXWaitVideoSyncSGI failed");
+			break;
+		}
+		vb.t=get_current_time();
+		vb.count=count;
+		td_spsc_push(&v->ring, &vb);
+	}
+	glXMakeCurrent(v->dpy, None, NULL);
+	td_atomic_store(&v->running, 0);
+	TD_THREAD_RETURN;
+}
+#endif
+
+/* needs the binding extensions loaded for the main window */
+static void
+td_vblank_start(TDVblankThread *v, GLFWwindow *win)
+{
+	if (!v->enabled || v->active) {
+		return;
+	}
+#if defined(LINUX)
+	if (!GLAD_GLX_SGI_video_sync) {
+		warn("GLX_SGI_video_sync not available, vblank thread disabled");
+		v->enabled=0;
+		return;
+	}
+	if (!v->ring.data && td_spsc_init(&v->ring, sizeof(TDVblank), VBLANK_RING_SIZE)) {
+		v->enabled=0;
+		return;
+	}
+	if (!(v->win=td_win_create_hidden(NULL))) {
+		warn("vblank thread disabled");
+		v->enabled=0;
+		return;
+	}
+	v->dpy=glfwGetX11Display();
+	v->drawable=glfwGetX11Window(win);
+	v->run=1;
+	v->running=1;
+	if (td_thread_create(&v->thread, td_vblank_thread, v)) {
+		warn("failed to create vblank thread");
+		glfwDestroyWindow(v->win);
+		v->win=NULL;
+		v->enabled=0;
+		return;
+	}
+	v->active=1;
+	info(2,"started vblank thread");
+#else
+	(void)win;
+	warn("vblank thread not implemented for this platform");
+	v->enabled=0;
+#endif
+}
+
+/* the thread delivers vblanks, it gives up if waiting for one fails */
+static int
+td_vblank_running(const TDVblankThread *v)
+{
+	return v->active && td_atomic_load(&v->running);
+}
+
+/* must be called before the main window is destroyed, blocks until the
+ * next vblank */
+static void
+td_vblank_stop(TDVblankThread *v)
+{
+	if (!v->active) {
+		return;
+	}
+	td_atomic_store(&v->run, 0);
+	td_thread_join(v->thread);
+	glfwDestroyWindow(v->win);
+	v->win=NULL;
+	v->active=0;
+	info(2,"stopped vblank thread");
+}
+
+static void
+td_vblank_destroy(TDVblankThread *v)
+{
+	td_vblank_stop(v);
+	if (v->ring.data) {
+		td_spsc_destroy(&v->ring);
+	}
+}
+
+/* move the new vblanks into the history, feeding the refresh estimator */
+static void
+td_vblank_drain(TDVblankThread *v, TDRefreshEst *r)
+{
+	TDVblank vb;
+
+	while (td_spsc_pop(&v->ring, &vb)) {
+		if (v->received) {
+			const TDVblank *prev=&v->history[(v->received - 1) & (VBLANK_HISTORY - 1)];
+			if (vb.count - prev->count > 1) {
+				v->missed += vb.count - prev->count - 1;
+			}
+		}
+		v->history[v->received & (VBLANK_HISTORY - 1)]=vb;
+		v->received++;
+		td_refresh_update(r, vb.t);
+	}
+}
+
+/* find the last vblank at or before t, returns 0 if it is in the history */
+static int
+td_vblank_find(const TDVblankThread *v, uint64_t t, TDVblank *vb)
+{
+	unsigned int i,n=(v->received < VBLANK_HISTORY)?v->received:VBLANK_HISTORY;
+
+	for (i=1; i<=n; i++) {
+		const TDVblank *h=&v->history[(v->received - i) & (VBLANK_HISTORY - 1)];
+		if (h->t <= t) {
+			*vb=*h;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+/****************************************************************************
+ * JUDDER DETECTOR                                                          *
+ ****************************************************************************/
+
+/* number of refreshes a frame deviated from the swap interval: 0 if it was
+ * on time, > 0 if late (the previous frame was shown that many refreshes
+ * too long), < 0 if early; returns -1 if it can't be classified */
+static int
+td_judder_classify(const TDRefreshEst *r, int interval, uint64_t delta, int *deviation)
+{
+	double n;
+
+	if (interval < 1 || !td_refresh_locked(r)) {
+		return -1;
+	}
+	n=floor((double)delta / r->period + 0.5);
+	*deviation=(int)n - interval;
+	return 0;
+}
+
+static void
+td_judder_end_burst(TDJudder *j)
+{
+	TDJudderBurst *b=&j->cur;
+	int i,k;
+
+	if (!b->frames) {
+		return;
+	}
+	j->bursts++;
+	if (b->frames > j->longest_burst) {
+		j->longest_burst=b->frames;
+	}
+	/* keep the worst bursts sorted by their total deviation */
+	for (i=0; i<JUDDER_WORST; i++) {
+		if (!j->worst[i].frames || b->refreshes > j->worst[i].refreshes) {
+			for (k=JUDDER_WORST-1; k>i; k--) {
+				j->worst[k]=j->worst[k-1];
+			}
+			j->worst[i]=*b;
+			break;
+		}
+	}
+	b->frames=0;
+	b->refreshes=0;
+}
+
+static void
+td_judder_record(TDJudder *j, const TDFrameRecord *rec, int deviation)
+{
+	if (!deviation) {
+		j->on_time++;
+		if (++j->run > j->longest_run) {
+			j->longest_run=j->run;
+		}
+		td_judder_end_burst(j);
+		return;
+	}
+	if (deviation > 0) {
+		j->late[((deviation > JUDDER_LATE_MAX)?JUDDER_LATE_MAX:deviation) - 1]++;
+		j->missed += (unsigned)deviation;
+	} else {
+		j->early++;
+		deviation=-deviation;
+	}
+	j->run=0;
+	if (!j->cur.frames) {
+		j->cur.t_start=rec->t_swap_ret;
+		j->cur.frame=rec->frame;
+	}
+	j->cur.frames++;
+	j->cur.refreshes += (unsigned)deviation;
+}
+
+static unsigned int
+td_judder_late(const TDJudder *j)
+{
+	unsigned int i,late=0;
+
+	for (i=0; i<JUDDER_LATE_MAX; i++) {
+		late += j->late[i];
+	}
+	return late;
+}
+
+static void
+td_judder_format(const TDJudder *j, char *buf, size_t size)
+{
+	if (!(j->on_time + j->early + td_judder_late(j))) {
+		my_snprintf(buf, size, "vblank: --");
+		return;
+	}
+	if (j->worst[0].frames) {
+		my_snprintf(buf, size, "vblank: %u on time, %u late (%u missed), %u early, "
+			"worst: %u frames/%u refreshes at frame %u",
+			j->on_time, td_judder_late(j), j->missed, j->early,
+			j->worst[0].frames, j->worst[0].refreshes, j->worst[0].frame);
+	} else {
+		my_snprintf(buf, size, "vblank: %u on time, %u late (%u missed), %u early",
+			j->on_time, td_judder_late(j), j->missed, j->early);
+	}
+}
+
+/****************************************************************************
+ * SHARED CONTEXT THREAD                                                    *
+ * A helper thread renders with a second GL context, shared with the main   *
+ * window: every frame it uploads size MiB into a texture of its own and    *
+ * renders from it into one of SHARED_TEXTURES shared textures. Finished   *
+ * textures are exchanged with the render thread triple buffered: the      *
+ * helper swaps its back texture with the middle one, the render thread    *
+ * takes the middle one once it is new. Fences order the GPU work of both  *
+ * contexts, so neither thread blocks on the other one.                    *
+ ****************************************************************************/
+
+static const char *td_shared_metric_name[TDSHARED_METRIC_COUNT]={
+	"upload",
+	"submit",
+	"gpu",
+	"frame"
+};
+
+static void
+td_shared_init(TDShared *s)
+{
+	int i;
+
+	memset(s, 0, sizeof(*s));
+	for (i=0; i<TDSHARED_METRIC_COUNT; i++) {
+		td_hist_reset(&s->hist[i]);
+	}
+	td_hist_reset(&s->latency[0]);
+	td_hist_reset(&s->latency[1]);
+}
+
+TD_THREAD_FUNC(td_shared_thread, arg)
+{
+	static const GLchar *vs=
+		"#version 330 core\n"
+		"out vec2 uv;\n"
+		"void main()\n"
+		"{\n"
+		"	uv=vec2(float(gl_VertexID & 1), float(gl_VertexID >> 1)) * 2.0;\n"
+		"	gl_Position=vec4(uv * 2.0 - 1.0, 0.0, 1.0);\n"
+		"}\n";
+	static const GLchar *fs=
+		"#version 330 core\n"
+		"uniform sampler2D src;\n"
+		"uniform float t;\n"
+		"in vec2 uv;\n"
+		"out vec4 color;\n"
+		"void main()\n"
+		"{\n"
+		"	vec4 c=texture(src, uv + vec2(t * 0.01, 0.0));\n"
+		"	float band=step(0.5, fract(uv.x * 8.0 + t * 0.05));\n"
+		"	color=vec4(mix(c.rgb, vec3(band, 1.0 - band, 0.5), 0.5), 1.0);\n"
+		"}\n";
+	TDShared *s=(TDShared*)arg;
+	size_t bytes=(size_t)s->cur_size * 1024 * 1024;
+	GLsizei height=(GLsizei)(bytes / 4 / UPLOAD_WIDTH);
+	uint64_t period=(s->cur_fps > 0.0)?(uint64_t)(1000000000.0 / s->cur_fps):0;
+	uint64_t t_next,t_prev=0,t0,t1;
+	unsigned int back=2,frame=0;
+	unsigned char *data;
+	GLuint src,fbo,vao,program;
+	GLint loc_time;
+	GLsync done=NULL;
+	size_t i;
+
+	if (!(data=malloc(bytes))) {
+		warn("shared context: failed to allocate %u MiB", s->cur_size);
+		TD_THREAD_RETURN;
+	}
+	for (i=0; i<bytes; i++) {
+		data[i]=(unsigned char)(i * 13 + (i >> 12));
+	}
+	glfwMakeContextCurrent(s->win);
+	/* the program cache belongs to the main thread */
+	program=make_program_cached(NULL, vs, fs);
+	glUseProgram(program);
+	glUniform1i(glGetUniformLocation(program, "src"), 0);
+	loc_time=glGetUniformLocation(program, "t");
+	glGenVertexArrays(1, &vao);
+	glGenFramebuffers(1, &fbo);
+	glGenTextures(1, &src);
+	glBindTexture(GL_TEXTURE_2D, src);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, UPLOAD_WIDTH, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fbo);
+	glViewport(0, 0, SHARED_SIZE, SHARED_SIZE);
+	glBindVertexArray(vao);
+
+	t_next=get_current_time();
+	while (td_atomic_load(&s->run)) {
+		/* keep at most one frame in flight */
+		if (done) {
+			t0=get_current_time();
+			glClientWaitSync(done, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+			glDeleteSync(done);
+			done=NULL;
+			td_hist_record(&s->hist[TDSHARED_GPU], get_current_time() - t0);
+		}
+		if (period) {
+			t_next += period;
+			t0=get_current_time();
+			if (t_next > t0) {
+				sleep_until_nanoseconds(t_next);
+			} else {
+				t_next=t0;
+			}
+		}
+		/* the render thread may still read the back texture, or it was
+		 * replaced before it was shown */
+		if (s->released[back]) {
+			glWaitSync(s->released[back], 0, GL_TIMEOUT_IGNORED);
+			glDeleteSync(s->released[back]);
+			s->released[back]=NULL;
+		}
+		if (s->ready[back]) {
+			glDeleteSync(s->ready[back]);
+			s->ready[back]=NULL;
+		}
+
+		data[(size_t)frame * 4096 % bytes]++;
+		t0=get_current_time();
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, UPLOAD_WIDTH, height, GL_RGBA, GL_UNSIGNED_BYTE, data);
+		t1=get_current_time();
+		td_hist_record(&s->hist[TDSHARED_UPLOAD], t1 - t0);
+		glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, s->tex[back], 0);
+		glUniform1f(loc_time, (GLfloat)frame);
+		glDrawArrays(GL_TRIANGLES, 0, 3);
+		s->ready[back]=glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		done=glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		glFlush();
+		t0=get_current_time();
+		td_hist_record(&s->hist[TDSHARED_SUBMIT], t0 - t1);
+		back=td_atomic_exchange(&s->middle, back | SHARED_NEW) & ~SHARED_NEW;
+		if (t_prev) {
+			td_hist_record(&s->hist[TDSHARED_FRAME], t0 - t_prev);
+		}
+		t_prev=t0;
+		td_atomic_store(&s->produced, s->produced + 1);
+		frame++;
+	}
+
+	if (done) {
+		glDeleteSync(done);
+	}
+	glFinish();
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+	glBindVertexArray(0);
+	glUseProgram(0);
+	glDeleteTextures(1, &src);
+	glDeleteFramebuffers(1, &fbo);
+	glDeleteVertexArrays(1, &vao);
+	glDeleteProgram(program);
+	glfwMakeContextCurrent(NULL);
+	free(data);
+	TD_THREAD_RETURN;
+}
+
+static void
+td_shared_gl_destroy(TDShared *s)
+{
+	int i;
+
+	glfwDestroyWindow(s->win);
+	s->win=NULL;
+	for (i=0; i<SHARED_TEXTURES; i++) {
+		if (s->ready[i]) {
+			glDeleteSync(s->ready[i]);
+			s->ready[i]=NULL;
+		}
+		if (s->released[i]) {
+			glDeleteSync(s->released[i]);
+			s->released[i]=NULL;
+		}
+	}
+	glDeleteTextures(SHARED_TEXTURES, s->tex);
+}
+
+/* must be called on the main thread, with the main context current */
+static void
+td_shared_stop(TDShared *s)
+{
+	if (!s->active) {
+		return;
+	}
+	td_atomic_store(&s->run, 0);
+	td_thread_join(s->thread);
+	td_shared_gl_destroy(s);
+	s->active=0;
+	info(2,"stopped shared context thread");
+}
+
+static void
+td_shared_start(TDShared *s, GLFWwindow *share)
+{
+	GLint max_size=0;
+	int i;
+
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_size);
+	if (s->size * (1024*1024/4/UPLOAD_WIDTH) > (unsigned int)max_size) {
+		s->size=(unsigned int)max_size / (1024*1024/4/UPLOAD_WIDTH);
+		warn("shared context: limited to %u MiB per frame", s->size);
+	}
+	if (!s->size || !(s->win=td_win_create_hidden(share))) {
+		s->size=0;
+		return;
+	}
+	glGenTextures(SHARED_TEXTURES, s->tex);
+	for (i=0; i<SHARED_TEXTURES; i++) {
+		glBindTexture(GL_TEXTURE_2D, s->tex[i]);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, SHARED_SIZE, SHARED_SIZE, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+	/* the helper must see the complete textures */
+	glFinish();
+
+	s->front=0;
+	s->middle=1;
+	s->shown=0;
+	s->produced=0;
+	s->cur_size=s->size;
+	s->cur_fps=s->fps;
+	s->run=1;
+	if (td_thread_create(&s->thread, td_shared_thread, s)) {
+		warn("failed to create shared context thread");
+		td_shared_gl_destroy(s);
+		s->size=0;
+		return;
+	}
+	s->active=1;
+	info(2,"started shared context thread (%u MiB per frame)", s->size);
+}
+
+/* framebuffers are not shared, so the one to blit from belongs to the window */
+static void
+td_shared_detach(TDShared *s)
+{
+	if (s->fbo) {
+		glDeleteFramebuffers(1, &s->fbo);
+		s->fbo=0;
+	}
+}
+
+/* apply the configuration, (re)starting the thread if it changed, this
+ * does nothing while there is no window; the helper context shares with
+ * the hidden share context if there is one, so it outlives the window */
+static void
+td_shared_update(TDShared *s, const TDWindow *w)
+{
+	if ((s->active && s->cur_size == s->size && s->cur_fps == s->fps) ||
+	    (!s->active && !s->size)) {
+		return;
+	}
+	if (!w->win) {
+		return;
+	}
+	td_shared_stop(s);
+	td_shared_start(s, (w->share)?w->share:w->win);
+}
+
+/* take the newest finished texture, if any, and show it in the upper
+ * right corner */
+static void
+td_shared_show(TDShared *s, const int *size)
+{
+	unsigned int front;
+
+	if (!s->active) {
+		return;
+	}
+	if (td_atomic_load(&s->middle) & SHARED_NEW) {
+		/* give the current texture back once the GPU is done with it */
+		s->released[s->front]=glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		glFlush();
+		front=td_atomic_exchange(&s->middle, s->front) & ~SHARED_NEW;
+		glWaitSync(s->ready[front], 0, GL_TIMEOUT_IGNORED);
+		glDeleteSync(s->ready[front]);
+		s->ready[front]=NULL;
+		s->front=front;
+		s->shown++;
+	}
+	if (!s->shown || size[0] < 4 || size[1] < 4) {
+		return;
+	}
+	if (!s->fbo) {
+		glGenFramebuffers(1, &s->fbo);
+	}
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, s->fbo);
+	glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, s->tex[s->front], 0);
+	glBlitFramebuffer(0, 0, SHARED_SIZE, SHARED_SIZE, size[0] - size[0]/4, size[1] - size[1]/4,
+		size[0], size[1], GL_COLOR_BUFFER_BIT, GL_LINEAR);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+}
+
+/****************************************************************************
+ * DIFFERENT DISPLAY MODES                                                  *
+ ****************************************************************************/
+
+/* ----------------------- TDDISP_NONE ------------------------------------*/
+
+static void
+td_disp_none(TDContext *ctx)
+{
+	(void)ctx;
+}
+
+/* ----------------------- TDDISP_COLORS ----------------------------------*/
+
+static void
+td_disp_colors(TDContext *ctx)
+{
+	static const GLfloat colors[][4]={
+		{1.0f, 0.0f, 0.0f, 1.0f},
+		{0.0f, 1.0f, 0.0f, 1.0f},
+		{0.0f, 0.0f, 1.0f, 1.0f},
+		{1.0f, 1.0f, 0.0f, 1.0f},
+		{0.0f, 0.0f, 0.0f, 1.0f},
+		{0.0f, 1.0f, 1.0f, 1.0f},
+		{1.0f, 0.0f, 1.0f, 1.0f},
+		{1.0f, 1.0f, 1.0f, 1.0f}
+	};
+	const GLfloat *c=&colors[ctx->frame % 8][0];
+	glClearColor(c[0], c[1], c[2], c[3]);
+	glClear(GL_COLOR_BUFFER_BIT);
+}
+
+/* ------------------------ TDDISP_PULSE ----------------------------------*/
+
+static void
+td_disp_pulse_init(TDPulse *pulse)
+{
+	pulse->speed=3.0f;
+}
+
+static void
+td_disp_pulse(TDContext *ctx)
+{
+	GLfloat v=sinf(ctx->time * ctx->pulse.speed)*0.5f+0.5f;
+	glClearColor(v,v,v,1.0f);
+	glClear(GL_COLOR_BUFFER_BIT);
+}
+
+/* ----------------------- TDDISP_BARS -----------------------------------*/
+
+static const GLchar *td_disp_bars_vs="#version 330 core\n"
+	"void main() {\n"
+	"	vec2 pos=vec2( (gl_VertexID & 2)>>1, 1 - (gl_VertexID & 1));\n"
+	"	gl_Position=vec4(pos*2.0-1.0,0,1);\n"
+	"}\n";
+
+static const GLchar *td_disp_bars_fs="#version 330 core\n"
+	"out vec4 color;\n"
+	"uniform vec3 data;\n"
+	"void main() {\n"
+	"	vec3 c[2]=vec3[2](vec3(0.0f, 0.0f, 0.0f),vec3(1.0f,1.0f,1.0f));\n"
+	"	color=vec4(c[(int(gl_FragCoord.x + data.z)/int(data.x))%2] ,1);\n"
+	"}\n";
+
+static void
+td_disp_bars_init(TDBars *bars)
+{
+	bars->program=0;
+	bars->vao=0;
+	bars->loc_data=-1;
+	bars->data[0]=32.0f;
+	bars->data[1]=16.0f*bars->data[0];
+	bars->data[2]=0.0f;
+}
+
+static void
+td_disp_bars_gl_init(TDBars *bars)
+{
+	bars->program=make_program(td_disp_bars_vs, td_disp_bars_fs);
+	bars->loc_data=glGetUniformLocation(bars->program, "data");
+}
+
+static void
+td_disp_bars_destroy(TDBars *bars)
+{
+	if (bars->program) {
+		glDeleteProgram(bars->program);
+		bars->program=0;
+	}
+}
+
+/* vertex arrays are not shared, they belong to the window's context */
+static void
+td_disp_bars_attach(TDBars *bars)
+{
+	glGenVertexArrays(1, &bars->vao);
+}
+
+static void
+td_disp_bars_detach(TDBars *bars)
+{
+	if (bars->vao) {
+		glDeleteVertexArrays(1, &bars->vao);
+		bars->vao=0;
+	}
+}
+
+static void
+td_disp_bars(TDContext *ctx)
+{
+	ctx->bars.data[2] = fmodf(ctx->bars.data[1] * ctx->time, ctx->bars.data[0]*2.0f);
+	glClear(GL_COLOR_BUFFER_BIT);
+	glUseProgram(ctx->bars.program);
+	glUniform3fv(ctx->bars.loc_data, 1, ctx->bars.data);
+	glBindVertexArray(ctx->bars.vao);
+	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+	glUseProgram(0);
+	glBindVertexArray(0);
+}
+
+/* ----------------------- TDDISP_LOAD -----------------------------------*/
+
+/* same pattern as the bars, the load only adds an invisible amount to the
+ * color so that the compiler can't drop it */
+static const GLchar *td_disp_load_fs="#version 330 core\n"
+	"out vec4 color;\n"
+	"uniform vec3 data;\n"
+	"uniform ivec4 load;\n"	/* iterations, reads per pixel, pixels, width */
+	"uniform samplerBuffer mem;\n"
+	"void main() {\n"
+	"	ivec2 p=ivec2(gl_FragCoord.xy);\n"
+	"	int idx=p.y*load.w + p.x;\n"
+	"	int texels=textureSize(mem);\n"
+	"	vec4 acc=vec4(0.0);\n"
+	"	vec2 v=gl_FragCoord.xy*0.001;\n"
+	"	for (int i=0; i<load.y; i++) {\n"
+	"		int t=idx + i*load.z;\n"
+	"		if (t >= texels) break;\n"
+	"		acc += texelFetch(mem, t);\n"
+	"	}\n"
+	"	for (int i=0; i<load.x; i++) {\n"
+	"		v=vec2(sin(v.y)*0.9 + v.x*0.1, cos(v.x)*0.9 + v.y*0.1);\n"
+	"	}\n"
+	"	vec3 c[2]=vec3[2](vec3(0.0f, 0.0f, 0.0f),vec3(1.0f,1.0f,1.0f));\n"
+	"	color=vec4(c[(int(gl_FragCoord.x + data.z)/int(data.x))%2] +\n"
+	"		vec3(abs(v.x + v.y) + dot(acc, vec4(1.0)))*1.0e-7, 1);\n"
+	"}\n";
+
+static void
+td_disp_load_init(TDLoad *load)
+{
+	load->program=0;
+	load->vao=0;
+	load->buffer=0;
+	load->tex=0;
+	load->loc_data=-1;
+	load->loc_load=-1;
+	load->iterations=256;
+	load->memory=64;
+	load->allocated=0;
+}
+
+static void
+td_disp_load_gl_init(TDLoad *load)
+{
+	load->program=make_program(td_disp_bars_vs, td_disp_load_fs);
+	load->loc_data=glGetUniformLocation(load->program, "data");
+	load->loc_load=glGetUniformLocation(load->program, "load");
+	glGenBuffers(1, &load->buffer);
+	glGenTextures(1, &load->tex);
+	load->allocated=0;
+}
+
+static void
+td_disp_load_destroy(TDLoad *load)
+{
+	if (load->program) {
+		glDeleteProgram(load->program);
+		load->program=0;
+	}
+	if (load->tex) {
+		glDeleteTextures(1, &load->tex);
+		load->tex=0;
+	}
+	if (load->buffer) {
+		glDeleteBuffers(1, &load->buffer);
+		load->buffer=0;
+	}
+	load->allocated=0;
+}
+
+static void
+td_disp_load_attach(TDLoad *load)
+{
+	glGenVertexArrays(1, &load->vao);
+}
+
+static void
+td_disp_load_detach(TDLoad *load)
+{
+	if (load->vao) {
+		glDeleteVertexArrays(1, &load->vao);
+		load->vao=0;
+	}
+}
+
+/* (re)allocate the buffer for load->memory MiB, limited to what a buffer
+ * texture can address */
+static void
+td_disp_load_alloc(TDLoad *load)
+{
+	GLint max_texels=0;
+	unsigned int max;
+
+	glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &max_texels);
+	max=(unsigned int)(max_texels / (1024*1024/4));
+	if (load->memory > max) {
+		warn("GPU load: buffer textures are limited to %u MiB", max);
+		load->memory=max;
+	}
+	glBindBuffer(GL_TEXTURE_BUFFER, load->buffer);
+	glBufferData(GL_TEXTURE_BUFFER, (GLsizeiptr)load->memory*1024*1024, NULL, GL_STATIC_DRAW);
+	if (GLAD_GL_VERSION_4_3 && load->memory) {
+		GLuint zero=0;
+		glClearBufferData(GL_TEXTURE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+	}
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+	glBindTexture(GL_TEXTURE_BUFFER, load->tex);
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA8, load->buffer);
+	glBindTexture(GL_TEXTURE_BUFFER, 0);
+	load->allocated=load->memory;
+	info(2,"GPU load: allocated %u MiB", load->allocated);
+}
+
+static void
+td_disp_load(TDContext *ctx)
+{
+	TDLoad *load=&ctx->load;
+	GLint pixels=ctx->win.size[0] * ctx->win.size[1];
+	GLint texels,reads=0;
+
+	if (load->allocated != load->memory) {
+		td_disp_load_alloc(load);
+	}
+	texels=(GLint)load->allocated * (1024*1024/4);
+	if (pixels > 0) {
+		reads=(texels + pixels - 1) / pixels;
+	}
+	ctx->bars.data[2] = fmodf(ctx->bars.data[1] * ctx->time, ctx->bars.data[0]*2.0f);
+	glClear(GL_COLOR_BUFFER_BIT);
+	glUseProgram(load->program);
+	glUniform3fv(load->loc_data, 1, ctx->bars.data);
+	glUniform4i(load->loc_load, (GLint)load->iterations, reads, pixels, ctx->win.size[0]);
+	glBindTexture(GL_TEXTURE_BUFFER, load->tex);
+	glBindVertexArray(load->vao);
+	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+	glBindTexture(GL_TEXTURE_BUFFER, 0);
+	glUseProgram(0);
+	glBindVertexArray(0);
+}
+
+/* ----------------------- TDDISP_PIPELINE -------------------------------*/
+
+static const GLchar *td_disp_pipeline_gbuffer_fs="#version 330 core\n"
+	"layout(location=0) out vec4 albedo;\n"
+	"layout(location=1) out vec4 normal;\n"
+	"layout(location=2) out vec4 material;\n"
+	"uniform vec3 data;\n"
+	"uniform vec2 scale;\n"	/* window to internal resolution */
+	"void main() {\n"
+	"	vec2 p=gl_FragCoord.xy / scale;\n"
+	"	vec3 c[2]=vec3[2](vec3(0.0f, 0.0f, 0.0f),vec3(1.0f,1.0f,1.0f));\n"
+	"	albedo=vec4(c[(int(p.x + data.z)/int(data.x))%2], 1);\n"
+	"	normal=vec4(normalize(vec3(sin(p*0.01), 1.0)), 0.0);\n"
+	"	material=vec4(fract(p*0.001), 0.5, 1.0);\n"
+	"}\n";
+
+static const GLchar *td_disp_pipeline_composite_fs="#version 330 core\n"
+	"out vec4 color;\n"
+	"uniform sampler2D albedo;\n"
+	"uniform sampler2D normal;\n"
+	"uniform sampler2D material;\n"
+	"void main() {\n"
+	"	ivec2 p=ivec2(gl_FragCoord.xy);\n"
+	"	vec3 n=texelFetch(normal, p, 0).xyz;\n"
+	"	vec4 m=texelFetch(material, p, 0);\n"
+	"	float light=max(dot(n, normalize(vec3(0.3, 0.3, 1.0))), 0.0);\n"
+	"	color=vec4(texelFetch(albedo, p, 0).rgb * (0.999 + 0.001*light*m.z), 1.0);\n"
+	"}\n";
+
+/* a small filter that barely changes the image, so the bars stay sharp */
+static const GLchar *td_disp_pipeline_post_fs="#version 330 core\n"
+	"out vec4 color;\n"
+	"uniform sampler2D src;\n"
+	"void main() {\n"
+	"	ivec2 p=ivec2(gl_FragCoord.xy);\n"
+	"	ivec2 m=textureSize(src, 0) - 1;\n"
+	"	vec4 n=texelFetch(src, clamp(p + ivec2(-1, 0), ivec2(0), m), 0) +\n"
+	"		texelFetch(src, clamp(p + ivec2( 1, 0), ivec2(0), m), 0) +\n"
+	"		texelFetch(src, clamp(p + ivec2( 0,-1), ivec2(0), m), 0) +\n"
+	"		texelFetch(src, clamp(p + ivec2( 0, 1), ivec2(0), m), 0);\n"
+	"	color=texelFetch(src, p, 0)*0.996 + n*0.001;\n"
+	"}\n";
+
+static const GLenum td_disp_pipeline_format[PIPELINE_TARGETS]={GL_RGBA8, GL_RGBA16F, GL_RGBA8};
+static const unsigned int td_disp_pipeline_bpp[PIPELINE_TARGETS]={4, 8, 4};
+static const GLenum td_disp_pipeline_buffers[PIPELINE_TARGETS]={
+	GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2
+};
+
+static void
+td_disp_pipeline_init(TDPipeline *p)
+{
+	memset(p, 0, sizeof(*p));
+	p->loc_data=-1;
+	p->loc_scale=-1;
+	p->passes=4;
+	p->samples=4;
+	p->scale=100;
+}
+
+static void
+td_disp_pipeline_gl_init(TDPipeline *p)
+{
+	p->prog_gbuffer=make_program(td_disp_bars_vs, td_disp_pipeline_gbuffer_fs);
+	p->loc_data=glGetUniformLocation(p->prog_gbuffer, "data");
+	p->loc_scale=glGetUniformLocation(p->prog_gbuffer, "scale");
+	p->prog_composite=make_program(td_disp_bars_vs, td_disp_pipeline_composite_fs);
+	glUseProgram(p->prog_composite);
+	glUniform1i(glGetUniformLocation(p->prog_composite, "albedo"), 0);
+	glUniform1i(glGetUniformLocation(p->prog_composite, "normal"), 1);
+	glUniform1i(glGetUniformLocation(p->prog_composite, "material"), 2);
+	glUseProgram(0);
+	p->prog_post=make_program(td_disp_bars_vs, td_disp_pipeline_post_fs);
+}
+
+static void
+td_disp_pipeline_free_targets(TDPipeline *p)
+{
+	if (p->fbo_ms) {
+		glDeleteFramebuffers(1, &p->fbo_ms);
+		glDeleteRenderbuffers(PIPELINE_TARGETS, p->rb);
+		p->fbo_ms=0;
+	}
+	if (p->fbo_gbuf) {
+		glDeleteFramebuffers(1, &p->fbo_gbuf);
+		glDeleteTextures(PIPELINE_TARGETS, p->tex_gbuf);
+		p->fbo_gbuf=0;
+	}
+	if (p->fbo_post[0]) {
+		glDeleteFramebuffers(2, p->fbo_post);
+		glDeleteTextures(2, p->tex_post);
+		p->fbo_post[0]=0;
+	}
+	p->size[0]=p->size[1]=0;
+	p->bytes=0;
+	p->valid=0;
+}
+
+static void
+td_disp_pipeline_destroy(TDPipeline *p)
+{
+	if (p->prog_gbuffer) {
+		glDeleteProgram(p->prog_gbuffer);
+		glDeleteProgram(p->prog_composite);
+		glDeleteProgram(p->prog_post);
+		p->prog_gbuffer=0;
+	}
+}
+
+static void
+td_disp_pipeline_attach(TDPipeline *p)
+{
+	glGenVertexArrays(1, &p->vao);
+	p->size[0]=p->size[1]=0;
+	p->valid=0;
+}
+
+/* the render targets depend on the window size anyway, so they go with
+ * the framebuffers, which are not shared */
+static void
+td_disp_pipeline_detach(TDPipeline *p)
+{
+	td_disp_pipeline_free_targets(p);
+	if (p->vao) {
+		glDeleteVertexArrays(1, &p->vao);
+		p->vao=0;
+	}
+}
+
+static GLuint
+td_disp_pipeline_texture(GLenum format, GLsizei width, GLsizei height)
+{
+	GLuint tex;
+
+	glGenTextures(1, &tex);
+	glBindTexture(GL_TEXTURE_2D, tex);
+	glTexImage2D(GL_TEXTURE_2D, 0, (GLint)format, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	return tex;
+}
+
+static int
+td_disp_pipeline_check(const char *name)
+{
+	GLenum status=glCheckFramebufferStatus(GL_FRAMEBUFFER);
+
+	if (status != GL_FRAMEBUFFER_COMPLETE) {
+		warn("pipeline: %s framebuffer incomplete: 0x%x", name, (unsigned)status);
+		return -1;
+	}
+	return 0;
+}
+
+static void
+td_disp_pipeline_alloc(TDPipeline *p, GLsizei width, GLsizei height)
+{
+	const GLenum *buffers=td_disp_pipeline_buffers;
+	GLint max_samples=0;
+	int i,err=0;
+
+	td_disp_pipeline_free_targets(p);
+	glGetIntegerv(GL_MAX_SAMPLES, &max_samples);
+	if (p->samples > (unsigned int)max_samples) {
+		warn("pipeline: at most %d MSAA samples are supported", max_samples);
+		p->samples=(unsigned int)max_samples;
+	}
+
+	glGenFramebuffers(1, &p->fbo_gbuf);
+	glBindFramebuffer(GL_FRAMEBUFFER, p->fbo_gbuf);
+	for (i=0; i<PIPELINE_TARGETS; i++) {
+		p->tex_gbuf[i]=td_disp_pipeline_texture(td_disp_pipeline_format[i], width, height);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, buffers[i], GL_TEXTURE_2D, p->tex_gbuf[i], 0);
+		p->bytes += (uint64_t)width * height * td_disp_pipeline_bpp[i];
+	}
+	glDrawBuffers(PIPELINE_TARGETS, buffers);
+	err |= td_disp_pipeline_check("G-buffer");
+
+	if (p->samples) {
+		glGenFramebuffers(1, &p->fbo_ms);
+		glGenRenderbuffers(PIPELINE_TARGETS, p->rb);
+		glBindFramebuffer(GL_FRAMEBUFFER, p->fbo_ms);
+		for (i=0; i<PIPELINE_TARGETS; i++) {
+			glBindRenderbuffer(GL_RENDERBUFFER, p->rb[i]);
+			glRenderbufferStorageMultisample(GL_RENDERBUFFER, (GLsizei)p->samples,
+				td_disp_pipeline_format[i], width, height);
+			glFramebufferRenderbuffer(GL_FRAMEBUFFER, buffers[i], GL_RENDERBUFFER, p->rb[i]);
+			p->bytes += (uint64_t)width * height * td_disp_pipeline_bpp[i] * p->samples;
+		}
+		glBindRenderbuffer(GL_RENDERBUFFER, 0);
+		glDrawBuffers(PIPELINE_TARGETS, buffers);
+		err |= td_disp_pipeline_check("multisampled G-buffer");
+	}
+
+	glGenFramebuffers(2, p->fbo_post);
+	for (i=0; i<2; i++) {
+		p->tex_post[i]=td_disp_pipeline_texture(GL_RGBA16F, width, height);
+		glBindFramebuffer(GL_FRAMEBUFFER, p->fbo_post[i]);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, p->tex_post[i], 0);
+		p->bytes += (uint64_t)width * height * 8;
+		err |= td_disp_pipeline_check("post processing");
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	p->size[0]=width;
+	p->size[1]=height;
+	p->allocated_samples=p->samples;
+	p->valid=!err;
+	info(2,"pipeline: %dx%d, %u samples, %.1f MiB of render targets",
+		width, height, p->samples, p->bytes/(1024.0*1024.0));
+}
+
+static void
+td_disp_pipeline(TDContext *ctx)
+{
+	TDPipeline *p=&ctx->pipeline;
+	GLsizei width=(GLsizei)((ctx->win.size[0] * (int)p->scale + 50) / 100);
+	GLsizei height=(GLsizei)((ctx->win.size[1] * (int)p->scale + 50) / 100);
+	GLfloat scale[2];
+	unsigned int i,cur=0;
+	int j;
+
+	if (width < 1 || height < 1) {
+		return;
+	}
+	if (width != p->size[0] || height != p->size[1] || p->samples != p->allocated_samples) {
+		td_disp_pipeline_alloc(p, width, height);
+	}
+	if (!p->valid) {
+		glClear(GL_COLOR_BUFFER_BIT);
+		return;
+	}
+	ctx->bars.data[2] = fmodf(ctx->bars.data[1] * ctx->time, ctx->bars.data[0]*2.0f);
+	scale[0]=(GLfloat)width / (GLfloat)ctx->win.size[0];
+	scale[1]=(GLfloat)height / (GLfloat)ctx->win.size[1];
+	glViewport(0, 0, width, height);
+	glBindVertexArray(p->vao);
+
+	/* G-buffer */
+	glBindFramebuffer(GL_FRAMEBUFFER, (p->samples)?p->fbo_ms:p->fbo_gbuf);
+	glClear(GL_COLOR_BUFFER_BIT);
+	glUseProgram(p->prog_gbuffer);
+	glUniform3fv(p->loc_data, 1, ctx->bars.data);
+	glUniform2fv(p->loc_scale, 1, scale);
+	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+
+	/* MSAA resolve, one attachment at a time */
+	if (p->samples) {
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, p->fbo_ms);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, p->fbo_gbuf);
+		for (j=0; j<PIPELINE_TARGETS; j++) {
+			GLenum buf=GL_COLOR_ATTACHMENT0 + (GLenum)j;
+			glReadBuffer(buf);
+			glDrawBuffers(1, &buf);
+			glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+		}
+		glDrawBuffers(PIPELINE_TARGETS, td_disp_pipeline_buffers);
+	}
+
+	/* composite */
+	glBindFramebuffer(GL_FRAMEBUFFER, p->fbo_post[cur]);
+	glUseProgram(p->prog_composite);
+	for (j=0; j<PIPELINE_TARGETS; j++) {
+		glActiveTexture(GL_TEXTURE0 + (GLenum)j);
+		glBindTexture(GL_TEXTURE_2D, p->tex_gbuf[j]);
+	}
+	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+	for (j=PIPELINE_TARGETS-1; j>=0; j--) {
+		glActiveTexture(GL_TEXTURE0 + (GLenum)j);
+		glBindTexture(GL_TEXTURE_2D, 0);
+	}
+
+	/* post processing */
+	glUseProgram(p->prog_post);
+	for (i=0; i<p->passes; i++) {
+		glBindFramebuffer(GL_FRAMEBUFFER, p->fbo_post[cur^1]);
+		glBindTexture(GL_TEXTURE_2D, p->tex_post[cur]);
+		glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+		cur ^= 1;
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glUseProgram(0);
+	glBindVertexArray(0);
+
+	/* final blit */
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, p->fbo_post[cur]);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+	glBlitFramebuffer(0, 0, width, height, 0, 0, ctx->win.size[0], ctx->win.size[1],
+		GL_COLOR_BUFFER_BIT, (width == ctx->win.size[0] && height == ctx->win.size[1])?GL_NEAREST:GL_LINEAR);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glViewport(0, 0, ctx->win.size[0], ctx->win.size[1]);
+}
+
+/* ----------------------- TDDISP_DRAWS ---------------------------------*/
+
+static const GLchar *td_disp_draws_vs="#version 330 core\n"
+	"layout(location=0) in float index;\n"
+	"uniform vec4 grid;\n"	/* columns, rows, cell size */
+	"uniform float offset;\n"
+	"flat out float id;\n"
+	"void main() {\n"
+	"	float i=index + offset;\n"
+	"	vec2 cell=vec2(mod(i, grid.x), floor(i / grid.x));\n"
+	"	vec2 pos=vec2( (gl_VertexID & 2)>>1, 1 - (gl_VertexID & 1));\n"
+	"	gl_Position=vec4(-1.0 + (cell + pos*0.5)*grid.zw, 0, 1);\n"
+	"	id=i;\n"
+	"}\n";
+
+static const GLchar *td_disp_draws_fs[DRAWS_PROGRAMS]={
+	"#version 330 core\n"
+	"out vec4 color;\n"
+	"flat in float id;\n"
+	"void main() {\n"
+	"	color=vec4(fract(id*0.618), 0.2, 0.5, 1);\n"
+	"}\n",
+
+	"#version 330 core\n"
+	"out vec4 color;\n"
+	"flat in float id;\n"
+	"void main() {\n"
+	"	color=vec4(0.2, fract(id*0.382), 0.5, 1);\n"
+	"}\n"
+};
+
+static const char *td_draw_method_name[TDDRAW_METHOD_COUNT]={
+	"naive",
+	"instanced",
+	"indirect"
+};
+
+static void
+td_disp_draws_init(TDDraws *d)
+{
+	memset(d, 0, sizeof(*d));
+	d->count=10000;
+	d->method=TDDRAW_NAIVE;
+}
+
+static void
+td_disp_draws_gl_init(TDDraws *d)
+{
+	int i;
+
+	for (i=0; i<DRAWS_PROGRAMS; i++) {
+		d->program[i]=make_program(td_disp_draws_vs, td_disp_draws_fs[i]);
+		d->loc_grid[i]=glGetUniformLocation(d->program[i], "grid");
+		d->loc_offset[i]=glGetUniformLocation(d->program[i], "offset");
+	}
+	glGenBuffers(1, &d->index);
+	glGenBuffers(1, &d->indirect);
+	d->allocated=0;
+}
+
+static void
+td_disp_draws_destroy(TDDraws *d)
+{
+	int i;
+
+	for (i=0; i<DRAWS_PROGRAMS; i++) {
+		if (d->program[i]) {
+			glDeleteProgram(d->program[i]);
+			d->program[i]=0;
+		}
+	}
+	if (d->index) {
+		glDeleteBuffers(1, &d->index);
+		glDeleteBuffers(1, &d->indirect);
+		d->index=0;
+		d->indirect=0;
+	}
+	d->allocated=0;
+}
+
+static void
+td_disp_draws_attach(TDDraws *d)
+{
+	int i;
+
+	glGenVertexArrays(DRAWS_VAOS, d->vao);
+	glBindBuffer(GL_ARRAY_BUFFER, d->index);
+	for (i=0; i<DRAWS_VAOS; i++) {
+		glBindVertexArray(d->vao[i]);
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 1, GL_FLOAT, GL_FALSE, 0, NULL);
+		glVertexAttribDivisor(0, 1);
+	}
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+static void
+td_disp_draws_detach(TDDraws *d)
+{
+	if (d->vao[0]) {
+		glDeleteVertexArrays(DRAWS_VAOS, d->vao);
+		d->vao[0]=0;
+	}
+}
+
+/* the quad indices and one indirect command per quad, with the index as
+ * base instance */
+/* glMultiDrawArraysIndirect with a base instance per command */
+static int
+td_disp_indirect_supported(void)
+{
+	return GLAD_GL_VERSION_4_3 ||
+	       (GLAD_GL_ARB_multi_draw_indirect && GLAD_GL_ARB_base_instance);
+}
+
+static void
+td_disp_draws_alloc(TDDraws *d)
+{
+	GLfloat *index=malloc(sizeof(GLfloat) * d->count);
+	GLuint *cmd=malloc(sizeof(GLuint) * 4 * d->count);
+	unsigned int i;
+
+	if (!index || !cmd) {
+		warn("failed to allocate %u draws", d->count);
+		free(index);
+		free(cmd);
+		d->count=d->allocated;
+		return;
+	}
+	for (i=0; i<d->count; i++) {
+		index[i]=(GLfloat)i;
+		cmd[4*i]=4;		/* count */
+		cmd[4*i+1]=1;		/* instance count */
+		cmd[4*i+2]=0;		/* first */
+		cmd[4*i+3]=i;		/* base instance */
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, d->index);
+	glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)(sizeof(GLfloat) * d->count), index, GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	if (td_disp_indirect_supported()) {
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, d->indirect);
+		glBufferData(GL_DRAW_INDIRECT_BUFFER, (GLsizeiptr)(sizeof(GLuint) * 4 * d->count), cmd, GL_STATIC_DRAW);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	}
+	free(index);
+	free(cmd);
+	d->allocated=d->count;
+}
+
+static void
+td_disp_draws(TDContext *ctx)
+{
+	TDDraws *d=&ctx->draws;
+	TDDrawMethod method=d->method;
+	unsigned int i,half,columns;
+	GLfloat grid[4];
+
+	td_disp_bars(ctx);
+	if (!d->count) {
+		return;
+	}
+	if (d->allocated != d->count) {
+		td_disp_draws_alloc(d);
+	}
+	if (method == TDDRAW_INDIRECT && !td_disp_indirect_supported()) {
+		if (!d->warned) {
+			warn("glMultiDrawArraysIndirect not available, using instancing");
+			d->warned=1;
+		}
+		method=TDDRAW_INSTANCED;
+	}
+	columns=(unsigned int)ceil(sqrt((double)d->count));
+	grid[0]=(GLfloat)columns;
+	grid[1]=(GLfloat)((d->count + columns - 1) / columns);
+	grid[2]=2.0f / grid[0];
+	grid[3]=2.0f / grid[1];
+	for (i=0; i<DRAWS_PROGRAMS; i++) {
+		glUseProgram(d->program[i]);
+		glUniform4fv(d->loc_grid[i], 1, grid);
+		glUniform1f(d->loc_offset[i], 0.0f);
+	}
+	half=d->count/2;
+	switch (method) {
+		case TDDRAW_INSTANCED:
+			glBindVertexArray(d->vao[0]);
+			glUseProgram(d->program[0]);
+			glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, (GLsizei)half);
+			glUseProgram(d->program[1]);
+			glUniform1f(d->loc_offset[1], (GLfloat)half);
+			glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, (GLsizei)(d->count - half));
+			break;
+		case TDDRAW_INDIRECT:
+			glBindVertexArray(d->vao[0]);
+			glBindBuffer(GL_DRAW_INDIRECT_BUFFER, d->indirect);
+			glUseProgram(d->program[0]);
+			glMultiDrawArraysIndirect(GL_TRIANGLE_STRIP, NULL, (GLsizei)half, 0);
+			glUseProgram(d->program[1]);
+			glMultiDrawArraysIndirect(GL_TRIANGLE_STRIP, (const void*)(sizeof(GLuint) * 4 * half),
+				(GLsizei)(d->count - half), 0);
+			glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+			break;
+		default:
+			/* the index attribute is 0 without instancing, the uniform places the quad */
+			for (i=0; i<d->count; i++) {
+				glUseProgram(d->program[i % DRAWS_PROGRAMS]);
+				glBindVertexArray(d->vao[i % DRAWS_VAOS]);
+				glUniform1f(d->loc_offset[i % DRAWS_PROGRAMS], (GLfloat)i);
+				glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+			}
+	}
+	glUseProgram(0);
+	glBindVertexArray(0);
+}
+
+/* --------------------------- generic ------------------------------------*/
+
+static const char *td_disp_name[TDDISP_MODE_COUNT]={
+	"none",
+	"colors",
+	"pulse",
+	"bars",
+	"load",
+	"pipeline",
+	"draws"
+};
+
+static void
+td_disp(TDContext *ctx)
+{
+	switch (ctx->mode) {
+		case TDDISP_NONE:
+			td_disp_none(ctx);
+			break;
+		case TDDISP_COLORS:
+			td_disp_colors(ctx);
+			break;
+		case TDDISP_PULSE:
+			td_disp_pulse(ctx);
+			break;
+		case TDDISP_BARS:
+			td_disp_bars(ctx);
+			break;
+		case TDDISP_LOAD:
+			td_disp_load(ctx);
+			break;
+		case TDDISP_PIPELINE:
+			td_disp_pipeline(ctx);
+			break;
+		case TDDISP_DRAWS:
+			td_disp_draws(ctx);
+			break;
+		default:
+			info(0,"invalid display mode 0x%x",(unsigned)ctx->mode);
+	}
+	td_shared_show(&ctx->shared, ctx->win.size);
+}
+
+/* forced synchronization and simulated CPU load after drawing a frame */
+static void
+td_disp_post(TDContext *ctx)
+{
+	if (ctx->flags & TDCTX_GL_FLUSH) {
+		glFlush();
+	}
+
+	if (ctx->flags & TDCTX_GL_FINISH) {
+		glFinish();
+	}
+
+	if (ctx->busy_wait_ns) {
+		uint64_t now = get_current_time();
+		volatile int i;
+		while (get_current_time() - now < ctx->busy_wait_ns) {
+			cpu_pause();
+			i++;
+		}	
+		(void)i;
+	}
+	if (ctx->sleep_ns) {
+		sleep_nanoseconds(ctx->sleep_ns);
+	}
+}
+
+/****************************************************************************
+ * FRAME RATE CAP                                                           *
+ * Frames are scheduled against absolute deadlines, so errors don't add up. *
+ * clock_nanosleep(TIMER_ABSTIME) wakes up margin before the deadline, the *
+ * rest is spun with a pause instruction. The margin follows the measured  *
+ * oversleep: it grows quickly when the sleep overshoots it and decays      *
+ * slowly otherwise, so little CPU time is spun if the timer is precise.    *
+ ****************************************************************************/
+
+static void
+td_cap_init(TDFrameCap *c)
+{
+	c->deadline=0;
+	c->margin=FRAME_CAP_MARGIN_INIT;
+	c->oversleep=0;
+	c->resets=0;
+}
+
+/* sleep and spin until deadline, returns the time we got there */
+static uint64_t
+td_cap_wait_until(TDFrameCap *c, uint64_t deadline, uint64_t period)
+{
+	uint64_t now=get_current_time();
+	uint64_t wake;
+
+	if (c->margin > period/2) {
+		c->margin=period/2;
+	}
+	if (deadline > now + c->margin) {
+		wake=deadline - c->margin;
+		sleep_until_nanoseconds(wake);
+		now=get_current_time();
+		c->oversleep=(now > wake)?(now - wake):0;
+		if (c->oversleep > c->margin) {
+			c->margin += (c->oversleep - c->margin + 1) / 2;
+		} else if (c->margin > FRAME_CAP_MARGIN_MIN) {
+			c->margin -= (c->margin - c->oversleep) / 64;
+		}
+	}
+	while (now < deadline) {
+		cpu_pause();
+		now=get_current_time();
+	}
+	return now;
+}
+
+/* wait for the start of the next frame, returns the error against its
+ * deadline (> 0 if late) */
+static int64_t
+td_cap_wait(TDFrameCap *c, double fps)
+{
+	uint64_t period=(uint64_t)(1000000000.0 / fps);
+	uint64_t now=get_current_time();
+
+	if (!c->deadline || now > c->deadline + period) {
+		/* start over instead of rushing to catch up, but report
+		 * how late we were against the missed deadline */
+		int64_t late=(int64_t)(now - c->deadline);
+		if (!c->deadline) {
+			late=0;
+		} else {
+			c->resets++;
+		}
+		c->deadline=now + period;
+		return late;
+	}
+	now=td_cap_wait_until(c, c->deadline, period);
+	c->deadline += period;
+	return (int64_t)(now - (c->deadline - period));
+}
+
+/****************************************************************************
+ * JUST IN TIME CONTROLLER                                                  *
+ * Starts the frame as late as possible: from the vblank phase and period  *
+ * estimated by the refresh estimator, the moving average (plus three      *
+ * deviations) of the frame cost and a safety margin, the start is placed  *
+ * so that SwapBuffers is called margin before the targeted vblank. After  *
+ * a miss, the margin is doubled, after hits it slowly decays back to the  *
+ * configured value.                                                        *
+ ****************************************************************************/
+
+static void
+td_jit_init(TDJit *j, uint64_t margin)
+{
+	j->margin_min=margin;
+	j->margin=margin;
+	j->cost=0.0;
+	j->cost_dev=0.0;
+	j->hits=0;
+	j->misses=0;
+	j->backoff_frame=0;
+}
+
+/* wait until the frame should start, returns the targeted vblank or 0 if
+ * there is no stable refresh estimate */
+static uint64_t
+td_jit_wait(TDJit *j, TDFrameCap *cap, const TDRefreshEst *r)
+{
+	uint64_t now=get_current_time();
+	uint64_t lead,vblank,period;
+	double n;
+
+	if (!td_refresh_locked(r)) {
+		return 0;
+	}
+	period=(uint64_t)r->period;
+	lead=(uint64_t)(j->cost + 3.0*j->cost_dev) + j->margin;
+	/* the first vblank we can still make */
+	vblank=td_refresh_phase(r);
+	n=ceil((double)(int64_t)(now + lead - vblank) / r->period);
+	if (n > 0.0) {
+		vblank += (uint64_t)(n * r->period);
+	}
+	if (vblank > now + lead) {
+		td_cap_wait_until(cap, vblank - lead, period);
+	}
+	return vblank;
+}
+
+/* update the cost estimate after the swap was issued */
+static void
+td_jit_cost(TDJit *j, const TDFrameRecord *rec)
+{
+	double cost=(double)(rec->t_swap - rec->t_poll);
+
+	if (j->cost <= 0.0) {
+		j->cost=cost;
+	}
+	j->cost_dev += (fabs(cost - j->cost) - j->cost_dev) / 16.0;
+	j->cost += (cost - j->cost) / 16.0;
+}
+
+/* did the frame make its vblank? With present times or the vblank thread,
+ * judged by the vblank actually used, so that late GPU work counts as a
+ * miss; otherwise only by the time SwapBuffers was called */
+static int
+td_jit_missed(const TDFrameRecord *rec, double period)
+{
+	uint64_t limit=rec->jit_target + (uint64_t)(period/2.0);
+
+	if (rec->t_present) {
+		return (rec->t_present > limit);
+	}
+	if (rec->t_swap > rec->jit_target) {
+		return 1;
+	}
+	/* a blocking swap returns after the vblank it waited for */
+	return (rec->t_vblank > limit);
+}
+
+/* update the margin, returns missed; next is the first frame which will
+ * be started with a new margin */
+static int
+td_jit_result(TDJit *j, const TDFrameRecord *rec, int missed, double period, unsigned int next)
+{
+	if (missed) {
+		j->misses++;
+		/* frames started before the last back-off had no chance to
+		 * benefit from it, back off once per late frame only */
+		if ((int)(rec->frame - j->backoff_frame) >= 0) {
+			j->margin=j->margin*2 + 100000;
+			if (j->margin > (uint64_t)(period/2)) {
+				j->margin=(uint64_t)(period/2);
+			}
+			j->backoff_frame=next;
+		}
+		return 1;
+	}
+	j->hits++;
+	if (j->margin > j->margin_min) {
+		j->margin -= (j->margin - j->margin_min) / 32 + 1;
+	}
+	return 0;
+}
+
+/****************************************************************************
+ * CPU CONTENTION                                                           *
+ * Worker threads which are busy for duty percent of every 10ms, with one  *
+ * of several workloads: integer spinning, streaming through 64 MiB,       *
+ * random cache line accesses that thrash the caches, or wide FP vector    *
+ * math that can make the cores drop their frequency. The workers can be   *
+ * pinned to a list of CPUs. Duty cycle and workload are picked up by the  *
+ * running workers, a new thread count restarts the pool.                  *
+ ****************************************************************************/
+
+static const char *td_workload_name[TDWORKLOAD_COUNT]={
+	"spin",
+	"stream",
+	"thrash",
+	"simd"
+};
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+typedef float td_v16f __attribute__((vector_size(64)));
+typedef float td_v8f __attribute__((vector_size(32)));
+
+__attribute__((target("avx512f")))
+static float
+td_simd_avx512(unsigned int n)
+{
+	td_v16f a={0},b={0},c={0},d={0},m,k;
+	unsigned int i;
+
+	m=a + 0.999f;
+	k=a + 0.001f;
+	for (i=0; i<n; i++) {
+		a=a*m + k;
+		b=b*m + k;
+		c=c*m + k;
+		d=d*m + k;
+	}
+	a += b + c + d;
+	return a[0];
+}
+
+__attribute__((target("avx2,fma")))
+static float
+td_simd_avx2(unsigned int n)
+{
+	td_v8f a={0},b={0},c={0},d={0},m,k;
+	unsigned int i;
+
+	m=a + 0.999f;
+	k=a + 0.001f;
+	for (i=0; i<n; i++) {
+		a=a*m + k;
+		b=b*m + k;
+		c=c*m + k;
+		d=d*m + k;
+	}
+	a += b + c + d;
+	return a[0];
+}
+#endif
+
+static float
+td_simd_generic(unsigned int n)
+{
+	float a[16]={0};
+	unsigned int i,j;
+
+	for (i=0; i<n; i++) {
+		for (j=0; j<16; j++) {
+			a[j]=a[j]*0.999f + 0.001f;
+		}
+	}
+	return a[0];
+}
+
+static float
+td_simd(unsigned int n)
+{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	if (__builtin_cpu_supports("avx512f")) {
+		return td_simd_avx512(n);
+	}
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+		return td_simd_avx2(n);
+	}
+#endif
+	return td_simd_generic(n);
+}
+
+static const char *
+td_simd_name(void)
+{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	if (__builtin_cpu_supports("avx512f")) {
+		return "avx512";
+	}
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+		return "avx2";
+	}
+#endif
+	return "generic";
+}
+
+/* one piece of work, well below a millisecond */
+static void
+td_worker_chunk(TDWorker *w, TDWorkload workload)
+{
+	const size_t words=CONTENTION_MEMORY / sizeof(uint64_t);
+	uint64_t x=w->sink;
+	size_t i;
+
+	if (workload == TDWORKLOAD_STREAM || workload == TDWORKLOAD_THRASH) {
+		if (!w->mem && !(w->mem=calloc(words, sizeof(uint64_t)))) {
+			warn("CPU contention: failed to allocate memory, spinning instead");
+			workload=TDWORKLOAD_SPIN;
+		}
+	}
+	switch (workload) {
+		case TDWORKLOAD_STREAM:
+			/* 256 KiB per chunk */
+			for (i=0; i<32768; i++) {
+				x += w->mem[w->pos + i]++;
+			}
+			w->pos=(w->pos + 32768) % words;
+			break;
+		case TDWORKLOAD_THRASH:
+			/* one word of a random cache line each */
+			for (i=0; i<4096; i++) {
+				x ^= x << 13;
+				x ^= x >> 7;
+				x ^= x << 17;
+				w->mem[(x % (words/8))*8]++;
+			}
+			break;
+		case TDWORKLOAD_SIMD:
+			x += (uint64_t)td_simd(2048);
+			break;
+		default:
+			for (i=0; i<16384; i++) {
+				x=x*6364136223846793005ULL + 1442695040888963407ULL;
+			}
+	}
+	w->sink=x | 1;
+}
+
+TD_THREAD_FUNC(td_worker_thread, arg)
+{
+	TDWorker *w=(TDWorker*)arg;
+	TDContention *c=w->pool;
+
+	if (w->cpu >= 0 && td_thread_set_affinity(w->cpu)) {
+		warn("CPU contention: failed to pin a worker to CPU %d", w->cpu);
+	}
+	while (td_atomic_load(&c->run)) {
+		uint64_t start=get_current_time();
+		uint64_t busy=CONTENTION_PERIOD_NS / 100 * td_atomic_load(&c->cur_duty);
+		TDWorkload workload=(TDWorkload)td_atomic_load(&c->cur_workload);
+
+		while (get_current_time() - start < busy) {
+			td_worker_chunk(w, workload);
+			td_atomic_store(&w->chunks, w->chunks + 1);
+		}
+		if (busy < CONTENTION_PERIOD_NS) {
+			sleep_until_nanoseconds(start + CONTENTION_PERIOD_NS);
+		}
+	}
+	free(w->mem);
+	w->mem=NULL;
+	TD_THREAD_RETURN;
+}
+
+/* changes whenever a worker did some work */
+static unsigned int
+td_contention_work(TDContention *c)
+{
+	unsigned int i,sum=0;
+
+	for (i=0; i<c->active; i++) {
+		sum += td_atomic_load(&c->worker[i].chunks);
+	}
+	return sum;
+}
+
+static void
+td_contention_init(TDContention *c)
+{
+	c->threads=0;
+	c->duty=100;
+	c->workload=TDWORKLOAD_SPIN;
+	c->cpus=0;
+	c->active=0;
+	c->run=0;
+	td_hist_reset(&c->frame_time[0]);
+	td_hist_reset(&c->frame_time[1]);
+}
+
+/* parse a CPU list like "2-5,7" */
+static int
+td_contention_parse_cpus(TDContention *c, const char *str)
+{
+	char *end;
+	long first,last;
+
+	c->cpus=0;
+	while (*str) {
+		first=strtol(str, &end, 10);
+		if (end == str || first < 0) {
+			warn("invalid CPU list '%s'", str);
+			return -1;
+		}
+		last=first;
+		if (*end == '-') {
+			str=end+1;
+			last=strtol(str, &end, 10);
+			if (end == str || last < first) {
+				warn("invalid CPU list '%s'", str);
+				return -1;
+			}
+		}
+		if (last >= AFFINITY_CPUS_MAX) {
+			warn("CPU %ld out of range (0 - %ld)", last, AFFINITY_CPUS_MAX - 1);
+			return -1;
+		}
+		for (; first<=last && c->cpus < CONTENTION_THREADS_MAX; first++) {
+			c->cpu[c->cpus++]=(int)first;
+		}
+		str=(*end == ',')?(end+1):end;
+		if (*end && *end != ',') {
+			warn("invalid CPU list '%s'", end);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static void
+td_contention_stop(TDContention *c)
+{
+	unsigned int i;
+
+	if (!c->active) {
+		return;
+	}
+	td_atomic_store(&c->run, 0);
+	for (i=0; i<c->active; i++) {
+		td_thread_join(c->worker[i].thread);
+	}
+	info(2,"stopped %u worker threads", c->active);
+	c->active=0;
+}
+
+/* apply the configuration, (re)starting the pool if the thread count changed */
+static void
+td_contention_update(TDContention *c)
+{
+	unsigned int i;
+
+	td_atomic_store(&c->cur_duty, c->duty);
+	td_atomic_store(&c->cur_workload, (unsigned int)c->workload);
+	if (c->active == c->threads) {
+		return;
+	}
+	td_contention_stop(c);
+	td_atomic_store(&c->run, 1);
+	for (i=0; i<c->threads; i++) {
+		TDWorker *w=&c->worker[i];
+		w->pool=c;
+		w->cpu=(c->cpus)?c->cpu[i % c->cpus]:-1;
+		w->mem=NULL;
+		w->pos=0;
+		w->sink=i + 1;
+		if (td_thread_create(&w->thread, td_worker_thread, w)) {
+			warn("failed to create worker thread %u", i);
+			break;
+		}
+		c->active++;
+	}
+	if (c->active) {
+		info(2,"started %u worker threads (%s, %u%% duty)", c->active,
+			td_workload_name[c->workload], c->duty);
+	}
+}
+
+/****************************************************************************
+ * TEXTURE UPLOAD                                                           *
+ * Streams size MiB into a UPLOAD_WIDTH wide RGBA8 texture every frame,    *
+ * from client memory with glTexSubImage2D, through a single PBO that is    *
+ * orphaned every frame, through UPLOAD_BUFFERS PBOs used round robin, or  *
+ * through a persistently mapped ring of UPLOAD_BUFFERS regions. The round *
+ * robin PBOs and the ring regions are each guarded by a fence. The CPU time of the upload is measured directly, the GPU       *
+ * transfer time with a pair of timestamp queries around it.              *
+ ****************************************************************************/
+
+static const char *td_upload_method_name[TDUPLOAD_METHOD_COUNT]={
+	"teximage",
+	"orphan",
+	"pbo",
+	"persistent"
+};
+
+static void
+td_upload_init(TDUpload *u)
+{
+	memset(u, 0, sizeof(*u));
+	u->method=TDUPLOAD_PBO;
+	u->used=TDUPLOAD_PBO;
+}
+
+static void
+td_upload_gl_destroy(TDUpload *u)
+{
+	int i;
+
+	for (i=0; i<UPLOAD_BUFFERS; i++) {
+		if (u->fence[i]) {
+			glDeleteSync(u->fence[i]);
+			u->fence[i]=NULL;
+		}
+	}
+	if (u->mapped) {
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, u->pbo[0]);
+		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		u->mapped=NULL;
+	}
+	if (u->fbo) {
+		glDeleteFramebuffers(1, &u->fbo);
+		u->fbo=0;
+	}
+	if (u->tex) {
+		glDeleteTextures(1, &u->tex);
+		glDeleteBuffers(UPLOAD_BUFFERS, u->pbo);
+		u->tex=0;
+	}
+	u->allocated=0;
+}
+
+/* framebuffers are not shared, so the one for the thumbnail belongs to
+ * the window, and the persistent mapping is dropped with the context
+ * that created it */
+static void
+td_upload_detach(TDUpload *u)
+{
+	if (u->mapped) {
+		td_upload_gl_destroy(u);
+	}
+	if (u->fbo) {
+		glDeleteFramebuffers(1, &u->fbo);
+		u->fbo=0;
+	}
+}
+
+static void
+td_upload_destroy(TDUpload *u)
+{
+	free(u->data);
+	u->data=NULL;
+}
+
+static int
+td_upload_alloc(TDUpload *u)
+{
+	size_t bytes=(size_t)u->size * 1024 * 1024;
+	GLint max_size=0;
+	size_t i;
+	int j;
+
+	td_upload_gl_destroy(u);
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_size);
+	if (u->size * (1024*1024/4/UPLOAD_WIDTH) > (unsigned int)max_size) {
+		u->size=(unsigned int)max_size / (1024*1024/4/UPLOAD_WIDTH);
+		warn("texture upload: limited to %u MiB per frame", u->size);
+		bytes=(size_t)u->size * 1024 * 1024;
+	}
+	free(u->data);
+	if (!(u->data=malloc(bytes))) {
+		warn("texture upload: failed to allocate %u MiB", u->size);
+		return -1;
+	}
+	for (i=0; i<bytes; i++) {
+		u->data[i]=(unsigned char)(i * 7 + (i >> 12));
+	}
+	u->allocated_method=u->method;
+	u->used=u->method;
+	if (u->used == TDUPLOAD_PERSISTENT && !GLAD_GL_VERSION_4_4 && !GLAD_GL_ARB_buffer_storage) {
+		warn("texture upload: ARB_buffer_storage not available, using round robin PBOs");
+		u->used=TDUPLOAD_PBO;
+	}
+
+	glGenTextures(1, &u->tex);
+	glBindTexture(GL_TEXTURE_2D, u->tex);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, UPLOAD_WIDTH, (GLsizei)(bytes / 4 / UPLOAD_WIDTH), 0,
+		GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	glGenBuffers(UPLOAD_BUFFERS, u->pbo);
+	switch (u->used) {
+		case TDUPLOAD_PBO:
+			for (j=0; j<UPLOAD_BUFFERS; j++) {
+				glBindBuffer(GL_PIXEL_UNPACK_BUFFER, u->pbo[j]);
+				glBufferData(GL_PIXEL_UNPACK_BUFFER, (GLsizeiptr)bytes, NULL, GL_STREAM_DRAW);
+			}
+			break;
+		case TDUPLOAD_PERSISTENT:
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, u->pbo[0]);
+			glBufferStorage(GL_PIXEL_UNPACK_BUFFER, (GLsizeiptr)(bytes * UPLOAD_BUFFERS), NULL,
+				GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT);
+			u->mapped=glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, (GLsizeiptr)(bytes * UPLOAD_BUFFERS),
+				GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT);
+			if (!u->mapped) {
+				warn("texture upload: persistent mapping failed");
+				glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+				td_upload_gl_destroy(u);
+				return -1;
+			}
+			break;
+		default:
+			break;
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	u->allocated=u->size;
+	info(2,"texture upload: %u MiB per frame via %s", u->size, td_upload_method_name[u->used]);
+	return 0;
+}
+
+/* wait until the GPU is done with buffer or region i */
+static void
+td_upload_wait(TDUpload *u, unsigned int i)
+{
+	if (u->fence[i]) {
+		glClientWaitSync(u->fence[i], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+		glDeleteSync(u->fence[i]);
+		u->fence[i]=NULL;
+	}
+}
+
+/* upload one frame worth of data and get the CPU time it took, returns 0
+ * if the data was actually uploaded */
+static int
+td_upload_frame(TDUpload *u, uint64_t *cpu)
+{
+	int ret=0;
+	size_t bytes;
+	GLsizei height;
+	uint64_t t0;
+	unsigned int cur;
+	void *dst;
+
+	if (u->allocated != u->size || u->allocated_method != u->method) {
+		if (td_upload_alloc(u)) {
+			u->size=0;
+			return -1;
+		}
+	}
+	bytes=(size_t)u->allocated * 1024 * 1024;
+	height=(GLsizei)(bytes / 4 / UPLOAD_WIDTH);
+	cur=u->frame++ % UPLOAD_BUFFERS;
+	/* change a little of the data every frame */
+	u->data[(size_t)u->frame * 4096 % bytes]++;
+
+	t0=get_current_time();
+	glBindTexture(GL_TEXTURE_2D, u->tex);
+	switch (u->used) {
+		case TDUPLOAD_ORPHAN:
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, u->pbo[0]);
+			glBufferData(GL_PIXEL_UNPACK_BUFFER, (GLsizeiptr)bytes, NULL, GL_STREAM_DRAW);
+			if ((dst=glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, (GLsizeiptr)bytes,
+				GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT))) {
+				memcpy(dst, u->data, bytes);
+				glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+				glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, UPLOAD_WIDTH, height, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+			} else {
+				ret=-1;
+			}
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			break;
+		case TDUPLOAD_PBO:
+			/* no invalidation, which would just be orphaning again: the
+			 * fence tells when the GPU is done with this buffer */
+			td_upload_wait(u, cur);
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, u->pbo[cur]);
+			if ((dst=glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, (GLsizeiptr)bytes,
+				GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT))) {
+				memcpy(dst, u->data, bytes);
+				glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+				glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, UPLOAD_WIDTH, height, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+				u->fence[cur]=glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+			} else {
+				ret=-1;
+			}
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			break;
+		case TDUPLOAD_PERSISTENT:
+			td_upload_wait(u, cur);
+			memcpy(u->mapped + cur * bytes, u->data, bytes);
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, u->pbo[0]);
+			glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, UPLOAD_WIDTH, height, GL_RGBA, GL_UNSIGNED_BYTE,
+				(const void*)(cur * bytes));
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			u->fence[cur]=glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+			break;
+		default:
+			glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, UPLOAD_WIDTH, height, GL_RGBA, GL_UNSIGNED_BYTE, u->data);
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+	*cpu=get_current_time() - t0;
+	return ret;
+}
+
+/* show the uploaded texture in the lower left corner, so it is used */
+static void
+td_upload_show(TDUpload *u, const int *size)
+{
+	GLint height;
+
+	if (!u->allocated || size[0] < 4 || size[1] < 4) {
+		return;
+	}
+	height=(GLint)u->allocated * (1024*1024/4/UPLOAD_WIDTH);
+	if (!u->fbo) {
+		glGenFramebuffers(1, &u->fbo);
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, u->fbo);
+		glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, u->tex, 0);
+	}
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, u->fbo);
+	glBlitFramebuffer(0, 0, UPLOAD_WIDTH, height, 0, 0, size[0]/4, size[1]/4,
+		GL_COLOR_BUFFER_BIT, GL_LINEAR);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+}
+
+/****************************************************************************
+ * FRAMES IN FLIGHT LIMITER                                                 *
+ * After each swap, a fence is inserted, and we wait for the fence of the  *
+ * frame frames_in_flight frames back. Unlike glFinish, this keeps up to   *
+ * that many frames pipelined.                                              *
+ ****************************************************************************/
+
+static const char *td_wait_name[TDWAIT_COUNT]={
+	"block",
+	"spin",
+	"yield"
+};
+
+static void
+td_limiter_init(TDFrameLimiter *l)
+{
+	memset(l, 0, sizeof(*l));
+}
+
+static void
+td_limiter_gl_destroy(TDFrameLimiter *l)
+{
+	unsigned int i;
+
+	for (i=0; i<=FRAMES_IN_FLIGHT_MAX; i++) {
+		if (l->fence[i]) {
+			glDeleteSync(l->fence[i]);
+			l->fence[i]=NULL;
+		}
+	}
+}
+
+/* returns the time spent waiting */
+static uint64_t
+td_limiter_wait(TDFrameLimiter *l, GLsync fence, TDWaitStrategy wait)
+{
+	uint64_t t0=get_current_time();
+	GLbitfield flags=GL_SYNC_FLUSH_COMMANDS_BIT;
+	GLenum res;
+
+	if (wait == TDWAIT_BLOCK) {
+		while ((res=glClientWaitSync(fence, flags, 100000000)) == GL_TIMEOUT_EXPIRED) {
+			flags=0;
+		}
+	} else {
+		while ((res=glClientWaitSync(fence, flags, 0)) == GL_TIMEOUT_EXPIRED) {
+			flags=0;
+			if (wait == TDWAIT_YIELD) {
+				td_thread_yield();
+			}
+		}
+	}
+	if (res == GL_WAIT_FAILED && !l->warned) {
+		warn("glClientWaitSync failed");
+		l->warned=1;
+	}
+	return get_current_time() - t0;
+}
+
+/* called after each swap, returns the time spent waiting */
+static uint64_t
+td_limiter_frame(TDFrameLimiter *l, unsigned int frames_in_flight, TDWaitStrategy wait)
+{
+	const unsigned int size=FRAMES_IN_FLIGHT_MAX + 1;
+	GLsync *cur=&l->fence[l->frame % size];
+	GLsync *prev;
+	uint64_t waited=0;
+
+	if (frames_in_flight > FRAMES_IN_FLIGHT_MAX) {
+		frames_in_flight=FRAMES_IN_FLIGHT_MAX;
+	}
+	if (*cur) {
+		glDeleteSync(*cur);
+	}
+	*cur=glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	prev=&l->fence[(l->frame + size - frames_in_flight) % size];
+	if (*prev && prev != cur) {
+		waited=td_limiter_wait(l, *prev, wait);
+		glDeleteSync(*prev);
+		*prev=NULL;
+	}
+	l->frame++;
+	return waited;
+}
+
+/****************************************************************************
+ * WINDOW TITLE                                                             *
+ ****************************************************************************/
+
+static void
+td_ctx_set_title(TDContext *ctx)
+{
+	char swapi[64],dropped[64],refresh[128],judder[256],complete[128],vbl[64];
+	char inflight[128],cap[128],jit[128],load[128],workers[128],upload[128],shared[128];
+	char pct[TDSTAT_COUNT][128];
+	/* room for all of the above at their full size, plus the numbers */
+	char title[sizeof(swapi) + sizeof(dropped) + sizeof(refresh) + sizeof(judder) +
+		sizeof(complete) + sizeof(vbl) + sizeof(inflight) + sizeof(cap) + sizeof(jit) +
+		sizeof(load) + sizeof(workers) + sizeof(upload) + sizeof(shared) + 3*sizeof(pct[0]) + 1024];
+	TDStats *stats=&ctx->stats[TDSCOPE_INTERVAL];
+	int i;
+
+	if (ctx->flags & TDCTX_SWAP_INTERVAL_SET) {
+		my_snprintf(swapi,sizeof(swapi),"%d",ctx->swapInterval);
+	} else {
+		my_snprintf(swapi,sizeof(swapi),"unset");
+	}
+	if (ctx->queries.dropped) {
+		my_snprintf(dropped,sizeof(dropped),", dropped: %u",ctx->queries.dropped);
+	} else {
+		dropped[0]=0;
+	}
+	td_refresh_format(&ctx->refresh, ctx->swapInterval, refresh, sizeof(refresh));
+	td_judder_format(&stats->judder, judder, sizeof(judder));
+	if (ctx->fps_cap > 0.0) {
+		my_snprintf(cap, sizeof(cap), ", cap: %.1fFPS (spin %.0fus, err p99: %.3fms)",
+			ctx->fps_cap, ctx->cap.margin/1000.0,
+			td_hist_percentile(&stats->hist[TDSTAT_CAP_ERROR], 99.0)/1000000.0);
+	} else {
+		cap[0]=0;
+	}
+	if (ctx->mode == TDDISP_LOAD) {
+		my_snprintf(load, sizeof(load), ", load: %u iterations, %u MiB",
+			ctx->load.iterations, ctx->load.memory);
+	} else if (ctx->mode == TDDISP_PIPELINE) {
+		my_snprintf(load, sizeof(load), ", pipeline: %dx%d, %ux MSAA, %u passes, %.1f MiB targets",
+			ctx->pipeline.size[0], ctx->pipeline.size[1], ctx->pipeline.samples,
+			ctx->pipeline.passes, ctx->pipeline.bytes/(1024.0*1024.0));
+	} else if (ctx->mode == TDDISP_DRAWS) {
+		my_snprintf(load, sizeof(load), ", draws: %u %s", ctx->draws.count,
+			td_draw_method_name[ctx->draws.method]);
+	} else {
+		load[0]=0;
+	}
+	if (ctx->upload.size) {
+		my_snprintf(upload, sizeof(upload), ", upload: %u MiB %s (cpu/xfer p50: %.3f/%.3fms)",
+			ctx->upload.size, td_upload_method_name[ctx->upload.used],
+			td_hist_percentile(&stats->hist[TDSTAT_UPLOAD_CPU], 50.0)/1000000.0,
+			td_hist_percentile(&stats->hist[TDSTAT_UPLOAD_GPU], 50.0)/1000000.0);
+	} else {
+		upload[0]=0;
+	}
+	if (ctx->shared.active) {
+		my_snprintf(shared, sizeof(shared), ", shared: %u MiB, %u/%u shown",
+			ctx->shared.cur_size, ctx->shared.shown, td_atomic_load(&ctx->shared.produced));
+	} else {
+		shared[0]=0;
+	}
+	if (ctx->contention.active) {
+		my_snprintf(workers, sizeof(workers), ", workers: %u %s at %u%%",
+			ctx->contention.active, td_workload_name[ctx->contention.workload],
+			ctx->contention.duty);
+	} else {
+		workers[0]=0;
+	}
+	if (ctx->jit_enabled) {
+		my_snprintf(jit, sizeof(jit), ", jit: %s (margin %.3fms, cost %.3fms, missed %u)",
+			(td_refresh_locked(&ctx->refresh))?"on":"waiting",
+			ctx->jit.margin/1000000.0, ctx->jit.cost/1000000.0, stats->jit_missed);
+	} else {
+		jit[0]=0;
+	}
+	if (ctx->frames_in_flight) {
+		my_snprintf(inflight, sizeof(inflight), ", inflight: %u (%s), fence p50: %.3fms",
+			ctx->frames_in_flight, td_wait_name[ctx->fence_wait],
+			td_hist_percentile(&stats->hist[TDSTAT_FENCE_WAIT], 50.0)/1000000.0);
+	} else {
+		inflight[0]=0;
+	}
+	if (td_vblank_running(&ctx->vblank)) {
+		my_snprintf(vbl, sizeof(vbl), ", vbl p50: %.3fms",
+			td_hist_percentile(&stats->hist[TDSTAT_VBLANK], 50.0)/1000000.0);
+	} else {
+		vbl[0]=0;
+	}
+	if (ctx->present.mode != TDPRESENT_QUERY) {
+		my_snprintf(complete, sizeof(complete), ", flip/copy/skip: %u/%u/%u, disp p50: %.3fms",
+			stats->complete[TDCOMPLETE_FLIP],
+			stats->complete[TDCOMPLETE_COPY] + stats->complete[TDCOMPLETE_SUBOPTIMAL_COPY],
+			stats->complete[TDCOMPLETE_SKIP],
+			td_hist_percentile(&stats->hist[TDSTAT_DISPLAY], 50.0)/1000000.0);
+	} else {
+		complete[0]=0;
+	}
+	for (i=0; i<TDSTAT_COUNT; i++) {
+		td_hist_format(&stats->hist[i], pct[i], sizeof(pct[i]));
+	}
+	my_snprintf(title, sizeof(title),
+		APPTITLE": [%u:%s] %.2fFPS, lat: %.3fms, cur_lat: %.3fms%s%s%s%s%s%s, sleep: %.1fms, busywait: %.1fms%s%s%s%s, "
+		"%s: %s, %s: %s, %s: %s, cpu/submit/gpu/queue p50: %.3f/%.3f/%.3f/%.3fms, %s, %s%s%s",
+		(unsigned)ctx->swapControlMode, swapi, ctx->avg_fps, ctx->avg_lat, ctx->cur_lat, 
+		((ctx->flags & TDCTX_GL_FLUSH)?", flush":""),
+		((ctx->flags & TDCTX_GL_FINISH)?", finish":""), inflight, cap, jit, load,
+		ctx->sleep_ns / 1000000.0, ctx->busy_wait_ns/1000000.0, upload, shared, workers, dropped,
+		td_stat_name[TDSTAT_FRAME_TIME], pct[TDSTAT_FRAME_TIME],
+		td_stat_name[TDSTAT_SWAP_CALL], pct[TDSTAT_SWAP_CALL],
+		td_stat_name[TDSTAT_LATENCY], pct[TDSTAT_LATENCY],
+		td_hist_percentile(&stats->hist[TDSTAT_CPU_RECORD], 50.0)/1000000.0,
+		td_hist_percentile(&stats->hist[TDSTAT_SUBMIT], 50.0)/1000000.0,
+		td_hist_percentile(&stats->hist[TDSTAT_GPU_EXEC], 50.0)/1000000.0,
+		td_hist_percentile(&stats->hist[TDSTAT_SWAP_QUEUE], 50.0)/1000000.0,
+		refresh, judder, complete, vbl);
+	if (ctx->win.flags & TDWIN_DECORATED) {
+		glfwSetWindowTitle(ctx->win.win, title);
+	}
+	info(0,"%s",title);
+}
+
+/****************************************************************************
+ * SWAP_CONTROL                                                             *
+ ****************************************************************************/
+
+static const char *td_swap_control_name[TDSWAP_CONTROL_COUNT]={
+#if defined(WIN32)
+	"EXT"
+#elif defined(LINUX)
+	"EXT",
+	"SGI",
+	"MESA"
+#endif
+};
+
+/* load the WGL/GLX extension pointers for the current window, once */
+static int
+td_ctx_load_binding_extensions(TDContext *ctx)
+{
+	if (ctx->flags & TDCTX_BINDING_EXTENSIONS_LOADED) {
+		return 0;
+	}
+#if defined(WIN32)
+	{
+		HWND hwin=glfwGetWin32Window(ctx->win.win);
+		HDC hdc=GetDC(hwin);
+		if (!gladLoadWGL(hdc)) {
+			warn("failed to load WGL extensions");
+			ReleaseDC(hwin,hdc);
+			return -1;
+		}
+		ReleaseDC(hwin,hdc);
+		info(2,"loaded WGL extensions");
+	}
+#elif defined(LINUX)
+	{
+		Display *dpy = glfwGetX11Display();
+		Window win=glfwGetX11Window(ctx->win.win);
+		int screen=0;
+		XWindowAttributes attr;
+		XGetWindowAttributes(dpy, win, &attr);
+		screen=XScreenNumberOfScreen(attr.screen);
+		if (!gladLoadGLX(dpy, screen)) {
+			warn("failed to load GLX extensions");
+			return -1;
+		}
+		info(2,"loaded GLX extensions");
+	}
+#else
+	return -1;
+#endif
+	ctx->flags |= TDCTX_BINDING_EXTENSIONS_LOADED;
+	return 0;
+}
+
+static void
+td_ctx_set_swap_interval(TDContext *ctx)
+{
+	const char *func="NONE";
+
+	if (td_ctx_load_binding_extensions(ctx)) {
+		return;
+	}
+#if defined(WIN32)
+	switch(ctx->swapControlMode) {
+		case TDSWAP_CONTROL_EXT:
+			func="EXT";
+			if (GLAD_WGL_EXT_swap_control) {
+				wglSwapIntervalEXT(ctx->swapInterval);
+			} else {
+				warn("wglSwapIntervalEXT not available");
+				return;
+			}
+			break;
+		default:
+			warn("swap control mode %u not available", (unsigned)ctx->swapControlMode);
+			return;
+	}
+	info(0,"setting swap interval to %d [wglSwapInterval%s]", ctx->swapInterval, func);
+#elif defined(LINUX)
+	Display *dpy = glfwGetX11Display();
+
+	switch(ctx->swapControlMode) {
+		case TDSWAP_CONTROL_EXT:
+			func="EXT";
+			if (GLAD_GLX_EXT_swap_control) {
+				GLXDrawable drawable=glXGetCurrentDrawable(dpy);
+				if (drawable == None) {
+					warn("failed to get current GLX drawable!");
+				}
+				glXSwapIntervalEXT(dpy, drawable, ctx->swapInterval);
+			} else {
+				warn("glXSwapIntervalEXT not available");
+				return;
+			}
+			break;
+		case TDSWAP_CONTROL_SGI:
+			func="SGI";
+			if (GLAD_GLX_SGI_swap_control) {
+				glXSwapIntervalSGI(ctx->swapInterval);
+			} else {
+				warn("glXSwapIntervalSGI not available");
+				return;
+			}
+			break;
+		/* TODO: glad currently does not have the MESA variant */
+		default:
+			warn("swap control mode %u not available", (unsigned)ctx->swapControlMode);
+			return;
+	}
+	info(0,"setting swap interval to %d [glXSwapInterval%s]", ctx->swapInterval, func);
+#else
+	warn("swap control not implemented for this platform");
+	return;
+#endif
+	ctx->flags |= TDCTX_SWAP_INTERVAL_SET;
+	td_ctx_set_title(ctx);
+}
+
+/****************************************************************************
+ * EVENT HANDLING                                                           *
+ ****************************************************************************/
+
+/* the switch is done in place by the main loop, unless recreate is set;
+ * without a window, only the flags for the next one are set */
+static void
+td_ctx_switch_fullscreen(TDContext *ctx, unsigned int fs_flags, int recreate)
+{
+	if (ctx->win.flags & TDWIN_FULLSCREEN) {
+		info(1,"switch to windowed mode requested");
+		ctx->win.flags &= ~(TDWIN_FULLSCREEN | TDWIN_FULLSCREEN_MODE_SWITCH);
+		ctx->win.flags |= TDWIN_DECORATED;
+	} else {
+		info(1,"switch to fullscreen requested");
+		ctx->win.flags &= ~(TDWIN_DECORATED | TDWIN_FULLSCREEN_MODE_SWITCH);
+		ctx->win.flags |= TDWIN_FULLSCREEN | fs_flags;
+	}
+	if (!ctx->win.win) {
+		return;
+	}
+	ctx->win_switch.t_request=get_current_time();
+	ctx->win_switch.recreate=recreate || (ctx->flags & TDCTX_FULLSCREEN_RECREATE);
+	ctx->win_switch.applied=0;
+	if (ctx->win_switch.recreate) {
+		ctx->flags |= TDCTX_DROP_WINDOW;
+	} else {
+		ctx->flags |= TDCTX_SWITCH_WINDOW;
+	}
+}
+
+/* called by the main loop after a switch was requested */
+static void
+td_ctx_switch_window(TDContext *ctx)
+{
+	ctx->flags &= ~TDCTX_SWITCH_WINDOW;
+	if (td_win_switch(&ctx->win)) {
+		info(1,"can't switch in place, recreating the window");
+		ctx->win_switch.recreate=1;
+		ctx->flags |= TDCTX_DROP_WINDOW;
+		return;
+	}
+	ctx->win_switch.applied=1;
+	td_refresh_init(&ctx->refresh, ctx->win.refresh_rate);
+	ctx->prev_swap_ret=0;
+	ctx->prev_msc=0;
+}
+
+/* the first frame after a switch returned from SwapBuffers */
+static void
+td_ctx_switch_done(TDContext *ctx, uint64_t t)
+{
+	TDWinSwitch *sw=&ctx->win_switch;
+
+	td_hist_record(&sw->time[(sw->recreate)?1:0], t - sw->t_request);
+	info(1,"fullscreen switch (%s): first frame after %.3fms",
+		(sw->recreate)?"recreated":"in place", (t - sw->t_request)/1000000.0);
+	sw->t_request=0;
+	sw->applied=0;
+}
+
+static void
+td_ctx_keyhandler(GLFWwindow *win, int key, int scancode, int action, int mods)
+{
+	TDContext *ctx=glfwGetWindowUserPointer(win);
+
+	(void)scancode;
+	if (action == GLFW_PRESS) {
+		switch(key) {
+			case GLFW_KEY_ESCAPE:
+				ctx->flags &= ~TDCTX_RUN;
+				break;
+			case GLFW_KEY_RIGHT:
+			case GLFW_KEY_SPACE:
+				if (++ctx->mode >= TDDISP_MODE_COUNT) {
+					ctx->mode -= TDDISP_MODE_COUNT;
+				}
+				info(5,"switched to mode %u",(unsigned)ctx->mode);
+				break;
+			case GLFW_KEY_LEFT:
+			case GLFW_KEY_BACKSPACE:
+				if (ctx->mode > (TDDisplayMode)0) {
+					ctx->mode--;
+				} else {
+					ctx->mode=TDDISP_MODE_COUNT-1;
+				}
+				info(5,"switched to mode %u",(unsigned)ctx->mode);
+				break;
+			case GLFW_KEY_ENTER:
+			case 'W':
+				ctx->flags |= TDCTX_DROP_WINDOW;
+				break;
+			case GLFW_KEY_UP:
+				ctx->pulse.speed *= 2.0f;
+				ctx->bars.data[1] *= 2.0f;
+				break;
+			case GLFW_KEY_DOWN:
+				ctx->pulse.speed /= 2.0f;
+				ctx->bars.data[1] /= 2.0f;
 				break;
 			case GLFW_KEY_HOME:
 				ctx->pulse.speed = 3.0f;
@@ -659,7 +5312,8 @@ td_ctx_keyhandler(GLFWwindow *win, int key, int scancode, int action, int mods)
 				ctx->bars.data[0] /= 2.0f;
 				break;
 			case 'F':
-				td_ctx_switch_fullscreen(ctx, (mods & GLFW_MOD_SHIFT)?TDWIN_FULLSCREEN_MODE_SWITCH:0);
+				td_ctx_switch_fullscreen(ctx, (mods & GLFW_MOD_SHIFT)?TDWIN_FULLSCREEN_MODE_SWITCH:0,
+					(mods & GLFW_MOD_CONTROL)?1:0);
 				break;
 			case 'S':
 				if (!(mods & GLFW_MOD_SHIFT)) {
@@ -691,71 +5345,1421 @@ td_ctx_keyhandler(GLFWwindow *win, int key, int scancode, int action, int mods)
 				if (ctx->swapControlMode > 0) {
 					ctx->swapControlMode--;
 
-				} else {
-					ctx->swapControlMode=TDSWAP_CONTROL_COUNT-1;
-				}
-				td_ctx_set_title(ctx);
-				break;
-			case 'B':
-				if ((mods & GLFW_MOD_SHIFT)) {
-					if (ctx->busy_wait_ns > 1000000) {
-						ctx->busy_wait_ns -= 1000000;
-					} else {
-						ctx->busy_wait_ns = 0;
-					}
-				} else {
-					ctx->busy_wait_ns += 1000000;
+				} else {
+					ctx->swapControlMode=TDSWAP_CONTROL_COUNT-1;
+				}
+				td_ctx_set_title(ctx);
+				break;
+			case 'B':
+				if ((mods & GLFW_MOD_SHIFT)) {
+					if (ctx->busy_wait_ns > 1000000) {
+						ctx->busy_wait_ns -= 1000000;
+					} else {
+						ctx->busy_wait_ns = 0;
+					}
+				} else {
+					ctx->busy_wait_ns += 1000000;
+				}
+				td_ctx_set_title(ctx);
+				break;
+			case 'V':
+				if ((mods & GLFW_MOD_SHIFT)) {
+					if (ctx->sleep_ns > 1000000) {
+						ctx->sleep_ns -= 1000000;
+					} else {
+						ctx->sleep_ns = 0;
+					}
+				} else {
+					ctx->sleep_ns += 1000000;
+				}
+				td_ctx_set_title(ctx);
+				break;
+			case 'C':
+				if ((mods & GLFW_MOD_SHIFT)) {
+					ctx->flags ^= TDCTX_GL_FLUSH;
+				} else {
+					ctx->flags ^= TDCTX_GL_FINISH;
+				}
+				td_ctx_set_title(ctx);
+				break;
+			case 'L':
+				if ((mods & GLFW_MOD_SHIFT)) {
+					if (ctx->frames_in_flight > 0) {
+						ctx->frames_in_flight--;
+					}
+				} else if (ctx->frames_in_flight < FRAMES_IN_FLIGHT_MAX) {
+					ctx->frames_in_flight++;
+				}
+				td_ctx_set_title(ctx);
+				break;
+			case 'P':
+				if ((mods & GLFW_MOD_SHIFT)) {
+					ctx->fps_cap=(ctx->fps_cap > 10.0)?(ctx->fps_cap - 10.0):0.0;
+				} else {
+					ctx->fps_cap += 10.0;
+				}
+				td_ctx_set_title(ctx);
+				break;
+			case 'G':
+				if ((mods & GLFW_MOD_SHIFT)) {
+					ctx->load.iterations=(ctx->load.iterations > 16)?(ctx->load.iterations/2):0;
+				} else if (ctx->load.iterations < GPU_LOAD_ITERATIONS_MAX) {
+					ctx->load.iterations=(ctx->load.iterations)?(ctx->load.iterations*2):16;
+				}
+				td_ctx_set_title(ctx);
+				break;
+			case 'M':
+				if ((mods & GLFW_MOD_SHIFT)) {
+					ctx->load.memory=(ctx->load.memory > 1)?(ctx->load.memory/2):0;
+				} else if (ctx->load.memory < GPU_LOAD_MEMORY_MAX) {
+					ctx->load.memory=(ctx->load.memory)?(ctx->load.memory*2):1;
+				}
+				td_ctx_set_title(ctx);
+				break;
+			case 'N':
+				if ((mods & GLFW_MOD_SHIFT)) {
+					if (ctx->pipeline.passes > 0) {
+						ctx->pipeline.passes--;
+					}
+				} else if (ctx->pipeline.passes < PIPELINE_PASSES_MAX) {
+					ctx->pipeline.passes++;
+				}
+				td_ctx_set_title(ctx);
+				break;
+			case 'X':
+				if ((mods & GLFW_MOD_SHIFT)) {
+					ctx->pipeline.samples=(ctx->pipeline.samples > 2)?(ctx->pipeline.samples/2):0;
+				} else if (ctx->pipeline.samples < 32) {
+					ctx->pipeline.samples=(ctx->pipeline.samples)?(ctx->pipeline.samples*2):2;
+				}
+				td_ctx_set_title(ctx);
+				break;
+			case 'R':
+				if ((mods & GLFW_MOD_SHIFT)) {
+					if (ctx->pipeline.scale > 25) {
+						ctx->pipeline.scale -= 25;
+					}
+				} else if (ctx->pipeline.scale + 25 <= PIPELINE_SCALE_MAX) {
+					ctx->pipeline.scale += 25;
+				}
+				td_ctx_set_title(ctx);
+				break;
+			case 'D':
+				if ((mods & GLFW_MOD_SHIFT)) {
+					ctx->draws.count=(ctx->draws.count > 1)?(ctx->draws.count/2):0;
+				} else if (ctx->draws.count < DRAWS_MAX) {
+					ctx->draws.count=(ctx->draws.count)?(ctx->draws.count*2):1000;
+					if (ctx->draws.count > DRAWS_MAX) {
+						ctx->draws.count=DRAWS_MAX;
+					}
+				}
+				td_ctx_set_title(ctx);
+				break;
+			case 'I':
+				if (++ctx->draws.method >= TDDRAW_METHOD_COUNT) {
+					ctx->draws.method=(TDDrawMethod)0;
+				}
+				td_ctx_set_title(ctx);
+				break;
+			case 'O':
+				if ((mods & GLFW_MOD_SHIFT)) {
+					ctx->upload.size=(ctx->upload.size > 1)?(ctx->upload.size/2):0;
+				} else if (ctx->upload.size < UPLOAD_MAX) {
+					ctx->upload.size=(ctx->upload.size)?(ctx->upload.size*2):8;
+				}
+				td_ctx_set_title(ctx);
+				break;
+			case 'A':
+				if (++ctx->upload.method >= TDUPLOAD_METHOD_COUNT) {
+					ctx->upload.method=(TDUploadMethod)0;
+				}
+				td_ctx_set_title(ctx);
+				break;
+			case 'H':
+				if ((mods & GLFW_MOD_SHIFT)) {
+					ctx->shared.size=(ctx->shared.size > 1)?(ctx->shared.size/2):0;
+				} else if (ctx->shared.size < SHARED_MAX) {
+					ctx->shared.size=(ctx->shared.size)?(ctx->shared.size*2):4;
+				}
+				td_shared_update(&ctx->shared, &ctx->win);
+				td_ctx_set_title(ctx);
+				break;
+			case 'T':
+				if ((mods & GLFW_MOD_SHIFT)) {
+					if (ctx->contention.threads > 0) {
+						ctx->contention.threads--;
+					}
+				} else if (ctx->contention.threads < CONTENTION_THREADS_MAX) {
+					ctx->contention.threads++;
+				}
+				td_contention_update(&ctx->contention);
+				td_ctx_set_title(ctx);
+				break;
+			case 'Y':
+				if (++ctx->contention.workload >= TDWORKLOAD_COUNT) {
+					ctx->contention.workload=(TDWorkload)0;
+				}
+				td_contention_update(&ctx->contention);
+				td_ctx_set_title(ctx);
+				break;
+			case 'U':
+				if ((mods & GLFW_MOD_SHIFT)) {
+					ctx->contention.duty=(ctx->contention.duty > 10)?(ctx->contention.duty - 10):0;
+				} else {
+					ctx->contention.duty=(ctx->contention.duty < 90)?(ctx->contention.duty + 10):100;
+				}
+				td_contention_update(&ctx->contention);
+				td_ctx_set_title(ctx);
+				break;
+			case 'J':
+				ctx->jit_enabled = !ctx->jit_enabled;
+				td_ctx_set_title(ctx);
+				break;
+			case 'K':
+				if (++ctx->fence_wait >= TDWAIT_COUNT) {
+					ctx->fence_wait=(TDWaitStrategy)0;
+				}
+				td_ctx_set_title(ctx);
+				break;
+		}
+
+	}
+
+}
+
+static void
+td_ctx_resize(GLFWwindow *win, int w, int h)
+{
+	TDContext *ctx=glfwGetWindowUserPointer(win);
+	ctx->win.size[0]=w;
+	ctx->win.size[1]=h;
+	if (!(ctx->win.flags & TDWIN_FULLSCREEN)) {
+		ctx->win.windowed_size[0]=w;
+		ctx->win.windowed_size[1]=h;
+	}
+}
+
+static void
+td_ctx_reposition(GLFWwindow *win, int x, int y)
+{
+	TDContext *ctx=glfwGetWindowUserPointer(win);
+	ctx->win.pos[0]=x;
+	ctx->win.pos[1]=y;
+	if (!(ctx->win.flags & TDWIN_FULLSCREEN)) {
+		ctx->win.windowed_pos[0]=x;
+		ctx->win.windowed_pos[1]=y;
+	}
+}
+
+/****************************************************************************
+ * BENCHMARK MODE                                                           *
+ * run for a fixed time after some warmup frames, or through the steps of a *
+ * scenario, then write a JSON summary                                      *
+ ****************************************************************************/
+
+static void
+td_bench_init(TDBench *b)
+{
+	b->active=0;
+	b->warmup=60;
+	b->duration_ns=10000000000ULL;
+	b->json=NULL;
+	b->frames=0;
+	b->measured=0;
+	b->t_start=0;
+	b->t_end=0;
+	b->scenario.step=NULL;
+	b->scenario.count=0;
+	b->scenario.cur=0;
+	b->scenario.warmup_left=0;
+	b->tune.max=0;
+	b->tune.cand=NULL;
+	b->tune.count=0;
+}
+
+static void
+td_bench_destroy(TDBench *b)
+{
+	unsigned int i;
+
+	for (i=0; i<b->scenario.count; i++) {
+		free(b->scenario.step[i].label);
+	}
+	free(b->scenario.step);
+	b->scenario.step=NULL;
+	b->scenario.count=0;
+	free(b->tune.cand);
+	b->tune.cand=NULL;
+	b->tune.count=0;
+}
+
+static TDScenarioStep *
+td_scenario_add_step(TDScenario *sc)
+{
+	TDScenarioStep *step=realloc(sc->step, (sc->count+1) * sizeof(*step));
+
+	if (!step) {
+		warn("failed to allocate scenario step");
+		return NULL;
+	}
+	sc->step=step;
+	step=&step[sc->count++];
+	memset(step, 0, sizeof(*step));
+	if (sc->count > 1) {
+		/* inherit the values, only the set flags decide what is applied */
+		step->settings=step[-1].settings;
+	}
+	return step;
+}
+
+static void
+td_ctx_get_settings(const TDContext *ctx, TDSettings *settings)
+{
+	settings->mode=ctx->mode;
+	settings->swapControlMode=ctx->swapControlMode;
+	settings->swapInterval=ctx->swapInterval;
+	settings->ctx_flags=ctx->flags;
+	settings->win_flags=ctx->win.flags;
+	settings->busy_wait_ns=ctx->busy_wait_ns;
+	settings->sleep_ns=ctx->sleep_ns;
+	settings->frames_in_flight=ctx->frames_in_flight;
+	settings->fence_wait=ctx->fence_wait;
+	settings->fps_cap=ctx->fps_cap;
+	settings->jit=ctx->jit_enabled;
+	settings->jit_margin_ns=ctx->jit.margin_min;
+	settings->gpu_iterations=ctx->load.iterations;
+	settings->gpu_memory=ctx->load.memory;
+	settings->passes=ctx->pipeline.passes;
+	settings->samples=ctx->pipeline.samples;
+	settings->scale=ctx->pipeline.scale;
+	settings->workers=ctx->contention.threads;
+	settings->duty=ctx->contention.duty;
+	settings->workload=ctx->contention.workload;
+	settings->draws=ctx->draws.count;
+	settings->draw_method=ctx->draws.method;
+	settings->upload=ctx->upload.size;
+	settings->upload_method=ctx->upload.method;
+	settings->shared=ctx->shared.size;
+	settings->shared_fps=ctx->shared.fps;
+}
+
+/* apply a scenario step the same way the key handler would */
+static void
+td_ctx_apply_step(TDContext *ctx, TDScenarioStep *step)
+{
+	const TDSettings *s=&step->settings;
+	int set_interval=0;
+
+	info(1,"scenario step %u: %s", ctx->bench.scenario.cur, step->label);
+	if (step->set & TDSTEP_MODE) {
+		ctx->mode=s->mode;
+	}
+	if (step->set & TDSTEP_SWAP_CONTROL) {
+		ctx->swapControlMode=s->swapControlMode;
+		set_interval=(ctx->flags & TDCTX_SWAP_INTERVAL_APPLY);
+	}
+	if (step->set & TDSTEP_INTERVAL) {
+		ctx->swapInterval=s->swapInterval;
+		ctx->flags |= TDCTX_SWAP_INTERVAL_APPLY;
+		set_interval=1;
+	}
+	if (step->set & TDSTEP_SLEEP) {
+		ctx->sleep_ns=s->sleep_ns;
+	}
+	if (step->set & TDSTEP_BUSY_WAIT) {
+		ctx->busy_wait_ns=s->busy_wait_ns;
+	}
+	if (step->set & TDSTEP_FLUSH) {
+		ctx->flags=(ctx->flags & ~TDCTX_GL_FLUSH) | (s->ctx_flags & TDCTX_GL_FLUSH);
+	}
+	if (step->set & TDSTEP_FINISH) {
+		ctx->flags=(ctx->flags & ~TDCTX_GL_FINISH) | (s->ctx_flags & TDCTX_GL_FINISH);
+	}
+	if (step->set & TDSTEP_IN_FLIGHT) {
+		ctx->frames_in_flight=s->frames_in_flight;
+	}
+	if (step->set & TDSTEP_FENCE_WAIT) {
+		ctx->fence_wait=s->fence_wait;
+	}
+	if (step->set & TDSTEP_FPS_CAP) {
+		ctx->fps_cap=s->fps_cap;
+	}
+	if (step->set & TDSTEP_GPU_ITERATIONS) {
+		ctx->load.iterations=s->gpu_iterations;
+	}
+	if (step->set & TDSTEP_GPU_MEMORY) {
+		ctx->load.memory=s->gpu_memory;
+	}
+	if (step->set & TDSTEP_PASSES) {
+		ctx->pipeline.passes=s->passes;
+	}
+	if (step->set & TDSTEP_SAMPLES) {
+		ctx->pipeline.samples=s->samples;
+	}
+	if (step->set & TDSTEP_SCALE) {
+		ctx->pipeline.scale=s->scale;
+	}
+	if (step->set & TDSTEP_DRAWS) {
+		ctx->draws.count=s->draws;
+	}
+	if (step->set & TDSTEP_DRAW_METHOD) {
+		ctx->draws.method=s->draw_method;
+	}
+	if (step->set & TDSTEP_UPLOAD) {
+		ctx->upload.size=s->upload;
+	}
+	if (step->set & TDSTEP_UPLOAD_METHOD) {
+		ctx->upload.method=s->upload_method;
+	}
+	if (step->set & TDSTEP_SHARED) {
+		ctx->shared.size=s->shared;
+	}
+	if (step->set & TDSTEP_SHARED_FPS) {
+		ctx->shared.fps=s->shared_fps;
+	}
+	if (step->set & (TDSTEP_SHARED | TDSTEP_SHARED_FPS)) {
+		td_shared_update(&ctx->shared, &ctx->win);
+	}
+	if (step->set & TDSTEP_WORKERS) {
+		ctx->contention.threads=s->workers;
+	}
+	if (step->set & TDSTEP_DUTY) {
+		ctx->contention.duty=s->duty;
+	}
+	if (step->set & TDSTEP_WORKLOAD) {
+		ctx->contention.workload=s->workload;
+	}
+	if (step->set & (TDSTEP_WORKERS | TDSTEP_DUTY | TDSTEP_WORKLOAD)) {
+		td_contention_update(&ctx->contention);
+	}
+	if (step->set & TDSTEP_JIT) {
+		ctx->jit_enabled=s->jit;
+		if (s->jit) {
+			td_jit_init(&ctx->jit, (s->jit_margin_ns != JIT_MARGIN_KEEP)?s->jit_margin_ns:
+				ctx->jit.margin_min);
+		}
+	}
+	if (step->set & TDSTEP_FULLSCREEN) {
+		unsigned int mask=TDWIN_FULLSCREEN | TDWIN_FULLSCREEN_MODE_SWITCH;
+		if ((ctx->win.flags & mask) != (s->win_flags & mask)) {
+			if (ctx->win.flags & TDWIN_FULLSCREEN) {
+				td_ctx_switch_fullscreen(ctx, 0, 0);
+			}
+			if (s->win_flags & TDWIN_FULLSCREEN) {
+				td_ctx_switch_fullscreen(ctx, s->win_flags & TDWIN_FULLSCREEN_MODE_SWITCH, 0);
+			}
+		}
+	}
+	/* a new window will get the interval anyway */
+	if (set_interval && ctx->win.win && !(ctx->flags & TDCTX_DROP_WINDOW)) {
+		td_ctx_set_swap_interval(ctx);
+	}
+	ctx->bench.scenario.warmup_left=(step->set & TDSTEP_WARMUP)?step->warmup:ctx->bench.warmup;
+	td_ctx_get_settings(ctx, &step->applied);
+	step->measured=0;
+	td_stats_reset(&step->stats);
+}
+
+/* ------------------- auto tuning ---------------------------------------*/
+
+/*
+ * Pareto local search over sleep, busy wait, frames in flight and
+ * flush/finish: starting from a few seeds, the candidate on the current
+ * Pareto frontier with the fewest tried moves is changed by one level of
+ * one parameter and measured as the next scenario step. This follows the
+ * frontier instead of measuring the whole grid, and stops when the budget
+ * is used up or no frontier candidate has untried neighbours left.
+ */
+
+static const uint64_t td_tune_wait_ns[]={0, 250000, 500000, 1000000, 2000000, 4000000, 8000000};
+static const unsigned int td_tune_in_flight[]={0, 3, 2, 1};	/* 0: unlimited */
+static const char *td_tune_sync_name[]={"none", "flush", "finish"};
+
+static const unsigned int td_tune_levels[TDTUNE_COUNT]={
+	sizeof(td_tune_wait_ns)/sizeof(td_tune_wait_ns[0]),
+	sizeof(td_tune_wait_ns)/sizeof(td_tune_wait_ns[0]),
+	sizeof(td_tune_in_flight)/sizeof(td_tune_in_flight[0]),
+	sizeof(td_tune_sync_name)/sizeof(td_tune_sync_name[0])
+};
+
+static void
+td_tune_result(const TDScenarioStep *step, TDTuneResult *r)
+{
+	const TDStats *stats=&step->stats;
+
+	r->latency=td_hist_percentile(&stats->hist[TDSTAT_LATENCY], 99.0);
+	r->missed=(stats->frames)?((double)stats->judder.missed/stats->frames):0.0;
+	r->frame_time=(step->measured)?((double)(step->t_end - step->t_start)/step->measured):0.0;
+}
+
+static int
+td_tune_dominates(const TDTuneResult *a, const TDTuneResult *b)
+{
+	if (a->latency > b->latency || a->missed > b->missed || a->frame_time > b->frame_time) {
+		return 0;
+	}
+	return (a->latency < b->latency || a->missed < b->missed || a->frame_time < b->frame_time);
+}
+
+/* score the measured candidates once all their frames are done */
+static void
+td_tune_score(TDBench *b)
+{
+	const TDScenario *sc=&b->scenario;
+	unsigned int i;
+
+	for (i=0; i<sc->cur && i<b->tune.count; i++) {
+		TDTuneCandidate *c=&b->tune.cand[i];
+		if (!c->scored && sc->step[i].measured) {
+			td_tune_result(&sc->step[i], &c->result);
+			c->scored=1;
+		}
+	}
+}
+
+/* is candidate i on the frontier of the first n candidates */
+static int
+td_tune_on_frontier(const TDTune *t, unsigned int n, unsigned int i)
+{
+	unsigned int j;
+
+	if (i >= t->count || !t->cand[i].scored) {
+		return 0;
+	}
+	for (j=0; j<n && j<t->count; j++) {
+		if (j != i && t->cand[j].scored && td_tune_dominates(&t->cand[j].result, &t->cand[i].result)) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static int
+td_tune_find(const TDTune *t, const unsigned char *level)
+{
+	unsigned int i;
+
+	for (i=0; i<t->count; i++) {
+		if (!memcmp(t->cand[i].level, level, TDTUNE_COUNT)) {
+			return (int)i;
+		}
+	}
+	return -1;
+}
+
+/* append a candidate as scenario step, its label is a valid scenario line */
+static int
+td_tune_add(TDBench *b, const unsigned char *level)
+{
+	TDTune *t=&b->tune;
+	TDScenarioStep *step;
+	TDSettings *s;
+	char label[256];
+	int sync=level[TDTUNE_SYNC];
+
+	if (t->count >= t->max || td_tune_find(t, level) >= 0) {
+		return -1;
+	}
+	if (!(step=td_scenario_add_step(&b->scenario))) {
+		return -1;
+	}
+	s=&step->settings;
+	s->sleep_ns=td_tune_wait_ns[level[TDTUNE_SLEEP]];
+	s->busy_wait_ns=td_tune_wait_ns[level[TDTUNE_BUSY_WAIT]];
+	s->frames_in_flight=td_tune_in_flight[level[TDTUNE_IN_FLIGHT]];
+	s->ctx_flags=((sync == 1)?TDCTX_GL_FLUSH:0) | ((sync == 2)?TDCTX_GL_FINISH:0);
+	step->set=TDSTEP_SLEEP | TDSTEP_BUSY_WAIT | TDSTEP_IN_FLIGHT | TDSTEP_FLUSH | TDSTEP_FINISH;
+	step->duration_ns=b->duration_ns;
+	my_snprintf(label, sizeof(label), "sleep %gms, busywait %gms, inflight %u, flush %s, finish %s",
+		s->sleep_ns/1000000.0, s->busy_wait_ns/1000000.0, s->frames_in_flight,
+		(sync == 1)?"on":"off", (sync == 2)?"on":"off");
+	step->label=strdup(label);
+	memcpy(t->cand[t->count].level, level, TDTUNE_COUNT);
+	t->cand[t->count].tried=0;
+	t->cand[t->count].scored=0;
+	t->count++;
+	return 0;
+}
+
+static int
+td_tune_start(TDBench *b)
+{
+	static const unsigned char seed[][TDTUNE_COUNT]={
+		{0, 0, 0, 0},	/* nothing */
+		{0, 0, 0, 2},	/* finish */
+		{0, 0, 3, 0},	/* one frame in flight */
+		{4, 0, 0, 0}	/* 2ms sleep */
+	};
+	unsigned int i;
+
+	if (!(b->tune.cand=calloc(b->tune.max, sizeof(*b->tune.cand)))) {
+		warn("failed to allocate auto tuning candidates");
+		return -1;
+	}
+	for (i=0; i<sizeof(seed)/sizeof(seed[0]); i++) {
+		td_tune_add(b, seed[i]);
+	}
+	return (b->scenario.count)?0:-1;
+}
+
+/* add the next candidate after the first sc->cur ones were measured,
+ * returns -1 when the search is done */
+static int
+td_tune_next(TDBench *b)
+{
+	TDTune *t=&b->tune;
+	const TDScenario *sc=&b->scenario;
+	unsigned char level[TDTUNE_COUNT];
+	unsigned int i,m,best,best_tried;
+	int found;
+
+	while (t->count < t->max) {
+		/* the frontier candidate with the fewest tried moves */
+		found=0;
+		best=0;
+		best_tried=0;
+		for (i=0; i<sc->cur; i++) {
+			unsigned int tried=t->cand[i].tried;
+			unsigned int n=0;
+			if (tried == (1U<<(2*TDTUNE_COUNT))-1 || !td_tune_on_frontier(t, sc->cur, i)) {
+				continue;
+			}
+			for (m=0; m<2*TDTUNE_COUNT; m++) {
+				n += (tried>>m) & 1;
+			}
+			if (!found || n < best_tried) {
+				found=1;
+				best=i;
+				best_tried=n;
+			}
+		}
+		if (!found) {
+			info(1,"auto tuning: frontier fully explored after %u candidates", t->count);
+			return -1;
+		}
+		/* move m changes parameter m/2 one level down (even) or up (odd) */
+		for (m=0; m<2*TDTUNE_COUNT; m++) {
+			unsigned int p=m/2;
+			if (t->cand[best].tried & (1U<<m)) {
+				continue;
+			}
+			t->cand[best].tried |= (1U<<m);
+			memcpy(level, t->cand[best].level, TDTUNE_COUNT);
+			if (m & 1) {
+				if (level[p] + 1U >= td_tune_levels[p]) {
+					continue;
 				}
-				td_ctx_set_title(ctx);
-				break;
-			case 'V':
-				if ((mods & GLFW_MOD_SHIFT)) {
-					if (ctx->sleep_ns > 1000000) {
-						ctx->sleep_ns -= 1000000;
-					} else {
-						ctx->sleep_ns = 0;
-					}
-				} else {
-					ctx->sleep_ns += 1000000;
+				level[p]++;
+			} else {
+				if (!level[p]) {
+					continue;
 				}
-				td_ctx_set_title(ctx);
+				level[p]--;
+			}
+			if (!td_tune_add(b, level)) {
+				info(1,"auto tuning: candidate %u is a neighbour of %u", t->count-1, best);
+				return 0;
+			}
+		}
+	}
+	return -1;
+}
+
+static void
+td_bench_start(TDContext *ctx)
+{
+	TDBench *b=&ctx->bench;
+
+	if (b->scenario.count) {
+		b->scenario.cur=0;
+		td_ctx_apply_step(ctx, &b->scenario.step[0]);
+	}
+	td_ctx_get_settings(ctx, &b->settings);
+}
+
+/* called for each frame directly after the swap */
+static void
+td_ctx_bench_frame(TDContext *ctx, TDFrameRecord *rec)
+{
+	TDBench *b=&ctx->bench;
+	TDScenario *sc=&b->scenario;
+	TDScenarioStep *step;
+
+	if (!b->active) {
+		return;
+	}
+	if (!sc->count) {
+		if (b->frames++ < b->warmup) {
+			rec->flags |= TDFRAME_WARMUP;
+			return;
+		}
+		if (!b->measured++) {
+			b->t_start=rec->t_poll;
+		}
+		b->t_end=rec->t_swap_ret;
+		if (b->t_end - b->t_start >= b->duration_ns) {
+			info(1,"benchmark finished after %u frames", b->measured);
+			ctx->flags &= ~TDCTX_RUN;
+		}
+		return;
+	}
+
+	b->frames++;
+	if (sc->cur >= sc->count) {
+		/* the auto tuner waits for the results of the last step */
+		rec->step=sc->cur;
+		rec->flags |= TDFRAME_WARMUP;
+		return;
+	}
+	step=&sc->step[sc->cur];
+	rec->step=sc->cur;
+	if (sc->warmup_left) {
+		sc->warmup_left--;
+		rec->flags |= TDFRAME_WARMUP;
+		return;
+	}
+	if (!step->measured++) {
+		step->t_start=rec->t_poll;
+		if (!b->measured) {
+			b->t_start=rec->t_poll;
+		}
+	}
+	b->measured++;
+	step->t_end=rec->t_swap_ret;
+	b->t_end=rec->t_swap_ret;
+	if (step->t_end - step->t_start >= step->duration_ns) {
+		info(1,"scenario step %u finished after %u frames", sc->cur, step->measured);
+		if (++sc->cur < sc->count) {
+			td_ctx_apply_step(ctx, &sc->step[sc->cur]);
+		} else if (b->tune.max) {
+			/* its frames are only done once their results are read back */
+			b->tune.waiting=1;
+		} else {
+			info(1,"scenario finished");
+			ctx->flags &= ~TDCTX_RUN;
+		}
+	}
+}
+
+/* called after the finished frames were harvested, picks the next auto
+ * tuning candidate once all frames of the last one are done */
+static void
+td_ctx_tune_poll(TDContext *ctx)
+{
+	TDBench *b=&ctx->bench;
+	TDScenario *sc=&b->scenario;
+	const TDScenarioStep *step;
+
+	if (!b->tune.waiting) {
+		return;
+	}
+	step=&sc->step[sc->cur-1];
+	if (step->stats.frames < step->measured) {
+		return;
+	}
+	b->tune.waiting=0;
+	td_tune_score(b);
+	if (!td_tune_next(b)) {
+		td_ctx_apply_step(ctx, &sc->step[sc->cur]);
+	} else {
+		info(1,"scenario finished");
+		ctx->flags &= ~TDCTX_RUN;
+	}
+}
+
+/* ------------------- option and scenario parsing -----------------------*/
+
+/* find str in the list of names, or parse it as index */
+static int
+td_parse_name(const char *str, const char *const *names, int count)
+{
+	char *end;
+	long val;
+	int i;
+
+	for (i=0; i<count; i++) {
+		if (!strcmp(str, names[i])) {
+			return i;
+		}
+	}
+	val=strtol(str, &end, 10);
+	if (*str && !*end && val >= 0 && val < count) {
+		return (int)val;
+	}
+	warn("invalid value '%s'", str);
+	return -1;
+}
+
+static int
+td_parse_double(const char *str, double *val)
+{
+	char *end;
+
+	*val=strtod(str, &end);
+	if (!*str || *end || *val < 0.0) {
+		warn("invalid value '%s'", str);
+		return -1;
+	}
+	return 0;
+}
+
+static int
+td_parse_int(const char *str, long min, long max, long *val)
+{
+	char *end;
+
+	*val=strtol(str, &end, 10);
+	if (!*str || *end || *val < min || *val > max) {
+		warn("invalid value '%s'", str);
+		return -1;
+	}
+	return 0;
+}
+
+/* parse a duration like "4ms", "10s", "500us", without unit in unit_ns */
+static int
+td_parse_duration(const char *str, uint64_t unit_ns, uint64_t *ns)
+{
+	static const struct {
+		const char *name;
+		uint64_t ns;
+	} units[]={
+		{"ns", 1ULL},
+		{"us", 1000ULL},
+		{"ms", 1000000ULL},
+		{"s", 1000000000ULL},
+		{"min", 60000000000ULL}
+	};
+	char *end;
+	double val;
+	size_t i;
+
+	val=strtod(str, &end);
+	if (end == str || val < 0.0) {
+		warn("invalid duration '%s'", str);
+		return -1;
+	}
+	if (*end) {
+		for (i=0; i<sizeof(units)/sizeof(units[0]); i++) {
+			if (!strcmp(end, units[i].name)) {
 				break;
-			case 'C':
-				if ((mods & GLFW_MOD_SHIFT)) {
-					ctx->flags ^= TDCTX_GL_FLUSH;
-				} else {
-					ctx->flags ^= TDCTX_GL_FINISH;
-				}
-				td_ctx_set_title(ctx);
+			}
+		}
+		if (i >= sizeof(units)/sizeof(units[0])) {
+			warn("invalid unit in duration '%s'", str);
+			return -1;
+		}
+		unit_ns=units[i].ns;
+	}
+	*ns=(uint64_t)(val * (double)unit_ns + 0.5);
+	return 0;
+}
+
+static int
+td_parse_bool(const char *str, int *val)
+{
+	if (!strcmp(str, "on") || !strcmp(str, "1") || !strcmp(str, "true")) {
+		*val=1;
+	} else if (!strcmp(str, "off") || !strcmp(str, "0") || !strcmp(str, "false")) {
+		*val=0;
+	} else {
+		warn("invalid value '%s', expected on or off", str);
+		return -1;
+	}
+	return 0;
+}
+
+/* parse one setting of a scenario step, returns number of consumed tokens or -1 */
+static int
+td_scenario_parse_setting(TDScenarioStep *step, char **tok, int ntok)
+{
+	TDSettings *s=&step->settings;
+	const char *key=tok[0];
+	const char *arg;
+	long l;
+	int v;
+
+	if (ntok < 2) {
+		warn("missing argument for '%s'", key);
+		return -1;
+	}
+	arg=tok[1];
+	if (!strcmp(key, "mode")) {
+		if ((v=td_parse_name(arg, td_disp_name, TDDISP_MODE_COUNT)) < 0) {
+			return -1;
+		}
+		s->mode=(TDDisplayMode)v;
+		step->set |= TDSTEP_MODE;
+	} else if (!strcmp(key, "swapcontrol")) {
+		if ((v=td_parse_name(arg, td_swap_control_name, TDSWAP_CONTROL_COUNT)) < 0) {
+			return -1;
+		}
+		s->swapControlMode=(TDSwapControlMode)v;
+		step->set |= TDSTEP_SWAP_CONTROL;
+	} else if (!strcmp(key, "interval")) {
+		if (td_parse_int(arg, INT_MIN, INT_MAX, &l)) {
+			return -1;
+		}
+		s->swapInterval=(int)l;
+		step->set |= TDSTEP_INTERVAL;
+	} else if (!strcmp(key, "sleep")) {
+		if (td_parse_duration(arg, 1000000ULL, &s->sleep_ns)) {
+			return -1;
+		}
+		step->set |= TDSTEP_SLEEP;
+	} else if (!strcmp(key, "busywait") || !strcmp(key, "busy")) {
+		if (td_parse_duration(arg, 1000000ULL, &s->busy_wait_ns)) {
+			return -1;
+		}
+		step->set |= TDSTEP_BUSY_WAIT;
+	} else if (!strcmp(key, "flush")) {
+		if (td_parse_bool(arg, &v)) {
+			return -1;
+		}
+		s->ctx_flags=(s->ctx_flags & ~TDCTX_GL_FLUSH) | ((v)?TDCTX_GL_FLUSH:0);
+		step->set |= TDSTEP_FLUSH;
+	} else if (!strcmp(key, "finish")) {
+		if (td_parse_bool(arg, &v)) {
+			return -1;
+		}
+		s->ctx_flags=(s->ctx_flags & ~TDCTX_GL_FINISH) | ((v)?TDCTX_GL_FINISH:0);
+		step->set |= TDSTEP_FINISH;
+	} else if (!strcmp(key, "inflight")) {
+		if (td_parse_int(arg, 0, FRAMES_IN_FLIGHT_MAX, &l)) {
+			return -1;
+		}
+		s->frames_in_flight=(unsigned int)l;
+		step->set |= TDSTEP_IN_FLIGHT;
+	} else if (!strcmp(key, "fencewait")) {
+		if ((v=td_parse_name(arg, td_wait_name, TDWAIT_COUNT)) < 0) {
+			return -1;
+		}
+		s->fence_wait=(TDWaitStrategy)v;
+		step->set |= TDSTEP_FENCE_WAIT;
+	} else if (!strcmp(key, "fpscap")) {
+		if (td_parse_double(arg, &s->fps_cap) || s->fps_cap < 0.0) {
+			return -1;
+		}
+		step->set |= TDSTEP_FPS_CAP;
+	} else if (!strcmp(key, "gpuiter")) {
+		if (td_parse_int(arg, 0, GPU_LOAD_ITERATIONS_MAX, &l)) {
+			return -1;
+		}
+		s->gpu_iterations=(unsigned int)l;
+		step->set |= TDSTEP_GPU_ITERATIONS;
+	} else if (!strcmp(key, "gpumem")) {
+		if (td_parse_int(arg, 0, GPU_LOAD_MEMORY_MAX, &l)) {
+			return -1;
+		}
+		s->gpu_memory=(unsigned int)l;
+		step->set |= TDSTEP_GPU_MEMORY;
+	} else if (!strcmp(key, "passes")) {
+		if (td_parse_int(arg, 0, PIPELINE_PASSES_MAX, &l)) {
+			return -1;
+		}
+		s->passes=(unsigned int)l;
+		step->set |= TDSTEP_PASSES;
+	} else if (!strcmp(key, "msaa")) {
+		if (td_parse_int(arg, 0, 32, &l)) {
+			return -1;
+		}
+		s->samples=(unsigned int)l;
+		step->set |= TDSTEP_SAMPLES;
+	} else if (!strcmp(key, "scale")) {
+		if (td_parse_int(arg, 10, PIPELINE_SCALE_MAX, &l)) {
+			return -1;
+		}
+		s->scale=(unsigned int)l;
+		step->set |= TDSTEP_SCALE;
+	} else if (!strcmp(key, "draws")) {
+		if (td_parse_int(arg, 0, DRAWS_MAX, &l)) {
+			return -1;
+		}
+		s->draws=(unsigned int)l;
+		step->set |= TDSTEP_DRAWS;
+	} else if (!strcmp(key, "drawmethod")) {
+		if ((v=td_parse_name(arg, td_draw_method_name, TDDRAW_METHOD_COUNT)) < 0) {
+			return -1;
+		}
+		s->draw_method=(TDDrawMethod)v;
+		step->set |= TDSTEP_DRAW_METHOD;
+	} else if (!strcmp(key, "upload")) {
+		if (td_parse_int(arg, 0, UPLOAD_MAX, &l)) {
+			return -1;
+		}
+		s->upload=(unsigned int)l;
+		step->set |= TDSTEP_UPLOAD;
+	} else if (!strcmp(key, "uploadmethod")) {
+		if ((v=td_parse_name(arg, td_upload_method_name, TDUPLOAD_METHOD_COUNT)) < 0) {
+			return -1;
+		}
+		s->upload_method=(TDUploadMethod)v;
+		step->set |= TDSTEP_UPLOAD_METHOD;
+	} else if (!strcmp(key, "shared")) {
+		if (td_parse_int(arg, 0, SHARED_MAX, &l)) {
+			return -1;
+		}
+		s->shared=(unsigned int)l;
+		step->set |= TDSTEP_SHARED;
+	} else if (!strcmp(key, "sharedfps")) {
+		if (td_parse_double(arg, &s->shared_fps) || s->shared_fps < 0.0) {
+			return -1;
+		}
+		step->set |= TDSTEP_SHARED_FPS;
+	} else if (!strcmp(key, "workers")) {
+		if (td_parse_int(arg, 0, CONTENTION_THREADS_MAX, &l)) {
+			return -1;
+		}
+		s->workers=(unsigned int)l;
+		step->set |= TDSTEP_WORKERS;
+	} else if (!strcmp(key, "duty")) {
+		if (td_parse_int(arg, 0, 100, &l)) {
+			return -1;
+		}
+		s->duty=(unsigned int)l;
+		step->set |= TDSTEP_DUTY;
+	} else if (!strcmp(key, "workload")) {
+		if ((v=td_parse_name(arg, td_workload_name, TDWORKLOAD_COUNT)) < 0) {
+			return -1;
+		}
+		s->workload=(TDWorkload)v;
+		step->set |= TDSTEP_WORKLOAD;
+	} else if (!strcmp(key, "jit")) {
+		if (!strcmp(arg, "off")) {
+			s->jit=0;
+		} else if (!strcmp(arg, "on")) {
+			s->jit=1;
+			s->jit_margin_ns=JIT_MARGIN_KEEP;
+		} else if (td_parse_duration(arg, 1000000ULL, &s->jit_margin_ns)) {
+			return -1;
+		} else {
+			s->jit=1;
+		}
+		step->set |= TDSTEP_JIT;
+	} else if (!strcmp(key, "fullscreen")) {
+		if (!strcmp(arg, "modeswitch")) {
+			s->win_flags=TDWIN_FULLSCREEN | TDWIN_FULLSCREEN_MODE_SWITCH;
+		} else if (td_parse_bool(arg, &v)) {
+			return -1;
+		} else {
+			s->win_flags=(v)?TDWIN_FULLSCREEN:0;
+		}
+		step->set |= TDSTEP_FULLSCREEN;
+	} else if (!strcmp(key, "warmup")) {
+		if (td_parse_int(arg, 0, INT_MAX, &l)) {
+			return -1;
+		}
+		step->warmup=(unsigned int)l;
+		step->set |= TDSTEP_WARMUP;
+	} else {
+		warn("unknown scenario setting '%s'", key);
+		return -1;
+	}
+	return 2;
+}
+
+/* join tokens with single blanks */
+static char *
+td_scenario_label(char **tok, int ntok)
+{
+	size_t len=1;
+	char *label;
+	int i;
+
+	for (i=0; i<ntok; i++) {
+		len += strlen(tok[i]) + 1;
+	}
+	if (!(label=malloc(len))) {
+		return NULL;
+	}
+	label[0]=0;
+	for (i=0; i<ntok; i++) {
+		if (i) {
+			strcat(label, " ");
+		}
+		strcat(label, tok[i]);
+	}
+	return label;
+}
+
+/*
+ * A scenario is a sequence of steps, each made of settings followed by
+ * "for <duration>", e.g. "interval 1, sleep 4ms for 10s; then finish on for 10s".
+ * Commas, semicolons and the word "then" are just separators, '#' starts a
+ * comment. Settings not mentioned in a step stay as they were.
+ */
+static int
+td_scenario_parse(TDScenario *sc, char *text)
+{
+	TDScenarioStep *step;
+	char **tok=NULL;
+	char *p;
+	int ntok=0,maxtok=0,i,first;
+
+	/* strip comments and separators, then split into tokens */
+	for (p=text; *p; p++) {
+		if (*p == '#') {
+			while (*p && *p != '\n') {
+				*p++=' ';
+			}
+			if (!*p) {
 				break;
+			}
+		}
+		if (*p == ',' || *p == ';') {
+			*p=' ';
+		}
+	}
+	for (p=strtok(text, " \t\r\n"); p; p=strtok(NULL, " \t\r\n")) {
+		if (!strcmp(p, "then")) {
+			continue;
+		}
+		if (ntok >= maxtok) {
+			char **t;
+			maxtok=(maxtok)?2*maxtok:64;
+			if (!(t=realloc(tok, maxtok * sizeof(*tok)))) {
+				free(tok);
+				return -1;
+			}
+			tok=t;
+		}
+		tok[ntok++]=p;
+	}
+
+	first=0;
+	step=NULL;
+	for (i=0; i<ntok; ) {
+		int n;
+
+		if (i == first && !(step=td_scenario_add_step(sc))) {
+			free(tok);
+			return -1;
+		}
+		if (!strcmp(tok[i], "for")) {
+			/* "for <duration>" terminates a step */
+			if (i+1 >= ntok) {
+				warn("missing duration after 'for'");
+				free(tok);
+				return -1;
+			}
+			if (td_parse_duration(tok[i+1], 1000000000ULL, &step->duration_ns)) {
+				free(tok);
+				return -1;
+			}
+			step->label=td_scenario_label(tok+first, i+2-first);
+			i += 2;
+			first=i;
+			continue;
 		}
+		if ((n=td_scenario_parse_setting(step, tok+i, ntok-i)) < 0) {
+			free(tok);
+			return -1;
+		}
+		i += n;
+	}
+	free(tok);
+	if (first != ntok) {
+		warn("last scenario step is missing 'for <duration>'");
+		return -1;
+	}
+	if (!sc->count) {
+		warn("scenario has no steps");
+		return -1;
+	}
+	return 0;
+}
+
+static int
+td_scenario_load(TDScenario *sc, const char *filename)
+{
+	FILE *f;
+	char *text;
+	long size;
+	int err;
+
+	if (!(f=fopen(filename, "rb"))) {
+		warn("failed to open scenario '%s'", filename);
+		return -1;
+	}
+	fseek(f, 0, SEEK_END);
+	size=ftell(f);
+	fseek(f, 0, SEEK_SET);
+	if (size < 0 || !(text=malloc((size_t)size+1))) {
+		fclose(f);
+		return -1;
+	}
+	size=(long)fread(text, 1, (size_t)size, f);
+	text[size]=0;
+	fclose(f);
+	err=td_scenario_parse(sc, text);
+	free(text);
+	if (err) {
+		warn("failed to parse scenario '%s'", filename);
+	} else {
+		info(1,"loaded scenario '%s' with %u steps", filename, sc->count);
+	}
+	return err;
+}
+
+/* ---------------------------- JSON output ------------------------------*/
+
+static void
+td_json_hist(FILE *f, const char *indent, const char *name, const TDHistogram *h, int last)
+{
+	fprintf(f, "%s\"%s\": {\"count\": %llu, \"min_ms\": %.6f, \"mean_ms\": %.6f, "
+		"\"p50_ms\": %.6f, \"p90_ms\": %.6f, \"p99_ms\": %.6f, \"p99_9_ms\": %.6f, "
+		"\"max_ms\": %.6f}%s\n",
+		indent, name, (unsigned long long)h->total, h->min/1000000.0, td_hist_mean(h)/1000000.0,
+		td_hist_percentile(h, 50.0)/1000000.0, td_hist_percentile(h, 90.0)/1000000.0,
+		td_hist_percentile(h, 99.0)/1000000.0, td_hist_percentile(h, 99.9)/1000000.0,
+		h->max/1000000.0, (last)?"":",");
+}
 
+/* write the vblank classification of a TDStats object as its "vblank" member */
+static void
+td_json_judder(FILE *f, const char *indent, const TDJudder *j)
+{
+	int i;
+
+	fprintf(f, "%s\"vblank\": {\"on_time\": %u, \"late\": [%u, %u, %u, %u], \"missed\": %u, "
+		"\"early\": %u, \"unclassified\": %u, \"bursts\": %u, \"longest_burst\": %u, "
+		"\"longest_run\": %u, \"worst\": [",
+		indent, j->on_time, j->late[0], j->late[1], j->late[2], j->late[3], j->missed,
+		j->early, j->unclassified, j->bursts, j->longest_burst, j->longest_run);
+	for (i=0; i<JUDDER_WORST && j->worst[i].frames; i++) {
+		fprintf(f, "%s{\"frame\": %u, \"t_ns\": %llu, \"frames\": %u, \"refreshes\": %u}",
+			(i)?", ":"", j->worst[i].frame, (unsigned long long)j->worst[i].t_start,
+			j->worst[i].frames, j->worst[i].refreshes);
 	}
+	fprintf(f, "]},\n");
+}
+
+/* write the members of a TDStats object, without the enclosing braces */
+static void
+td_json_stats(FILE *f, const char *indent, const TDStats *stats)
+{
+	char ind[64];
+	int i;
 
+	my_snprintf(ind, sizeof(ind), "%s\t", indent);
+	fprintf(f, "%s\"frames\": %u,\n", indent, stats->frames);
+	fprintf(f, "%s\"dropped\": %u,\n", indent, stats->dropped);
+	fprintf(f, "%s\"jit_missed\": %u,\n", indent, stats->jit_missed);
+	td_json_judder(f, indent, &stats->judder);
+	fprintf(f, "%s\"complete\": {", indent);
+	for (i=0; i<TDCOMPLETE_COUNT; i++) {
+		fprintf(f, "%s\"%s\": %u", (i)?", ":"", td_complete_name[i], stats->complete[i]);
+	}
+	fprintf(f, "},\n");
+	fprintf(f, "%s\"metrics\": {\n", indent);
+	for (i=0; i<TDSTAT_COUNT; i++) {
+		td_json_hist(f, ind, td_stat_name[i], &stats->hist[i], i+1 == TDSTAT_COUNT);
+	}
+	fprintf(f, "%s}", indent);
 }
 
 static void
-td_ctx_resize(GLFWwindow *win, int w, int h)
+td_json_string(FILE *f, const char *str)
 {
-	TDContext *ctx=glfwGetWindowUserPointer(win);
-	ctx->win.size[0]=w;
-	ctx->win.size[1]=h;
-	if (!(ctx->win.flags & TDWIN_FULLSCREEN)) {
-		ctx->win.windowed_size[0]=w;
-		ctx->win.windowed_size[1]=h;
+	fputc('"', f);
+	for (; *str; str++) {
+		if (*str == '"' || *str == '\\') {
+			fputc('\\', f);
+		}
+		fputc(*str, f);
 	}
+	fputc('"', f);
 }
 
 static void
-td_ctx_reposition(GLFWwindow *win, int x, int y)
+td_json_settings(FILE *f, const char *indent, const TDSettings *s)
 {
-	TDContext *ctx=glfwGetWindowUserPointer(win);
-	ctx->win.pos[0]=x;
-	ctx->win.pos[1]=y;
-	if (!(ctx->win.flags & TDWIN_FULLSCREEN)) {
-		ctx->win.windowed_pos[0]=x;
-		ctx->win.windowed_pos[1]=y;
+	const char *fullscreen="off";
+
+	if (s->win_flags & TDWIN_FULLSCREEN) {
+		fullscreen=(s->win_flags & TDWIN_FULLSCREEN_MODE_SWITCH)?"mode_switch":"windowed";
+	}
+	fprintf(f, "%s\"mode\": \"%s\",\n", indent, td_disp_name[s->mode]);
+	fprintf(f, "%s\"swap_control\": \"%s\",\n", indent, td_swap_control_name[s->swapControlMode]);
+	if (s->ctx_flags & TDCTX_SWAP_INTERVAL_APPLY) {
+		fprintf(f, "%s\"swap_interval\": %d,\n", indent, s->swapInterval);
+	} else {
+		fprintf(f, "%s\"swap_interval\": null,\n", indent);
+	}
+	fprintf(f, "%s\"sleep_ms\": %.3f,\n", indent, s->sleep_ns/1000000.0);
+	fprintf(f, "%s\"busy_wait_ms\": %.3f,\n", indent, s->busy_wait_ns/1000000.0);
+	fprintf(f, "%s\"flush\": %s,\n", indent, (s->ctx_flags & TDCTX_GL_FLUSH)?"true":"false");
+	fprintf(f, "%s\"finish\": %s,\n", indent, (s->ctx_flags & TDCTX_GL_FINISH)?"true":"false");
+	fprintf(f, "%s\"frames_in_flight\": %u,\n", indent, s->frames_in_flight);
+	fprintf(f, "%s\"fence_wait\": \"%s\",\n", indent, td_wait_name[s->fence_wait]);
+	fprintf(f, "%s\"fps_cap\": %.3f,\n", indent, s->fps_cap);
+	fprintf(f, "%s\"gpu_iterations\": %u,\n", indent, s->gpu_iterations);
+	fprintf(f, "%s\"gpu_memory_mb\": %u,\n", indent, s->gpu_memory);
+	fprintf(f, "%s\"pipeline\": {\"passes\": %u, \"msaa\": %u, \"scale_percent\": %u},\n",
+		indent, s->passes, s->samples, s->scale);
+	fprintf(f, "%s\"draws\": {\"count\": %u, \"method\": \"%s\"},\n",
+		indent, s->draws, td_draw_method_name[s->draw_method]);
+	fprintf(f, "%s\"upload\": {\"mb_per_frame\": %u, \"method\": \"%s\"},\n",
+		indent, s->upload, td_upload_method_name[s->upload_method]);
+	fprintf(f, "%s\"shared\": {\"mb_per_frame\": %u, \"fps\": %.3f},\n",
+		indent, s->shared, s->shared_fps);
+	fprintf(f, "%s\"workers\": {\"threads\": %u, \"duty_percent\": %u, \"workload\": \"%s\"},\n",
+		indent, s->workers, s->duty, td_workload_name[s->workload]);
+	if (s->jit) {
+		fprintf(f, "%s\"jit_margin_ms\": %.3f,\n", indent, s->jit_margin_ns/1000000.0);
+	} else {
+		fprintf(f, "%s\"jit_margin_ms\": null,\n", indent);
+	}
+	fprintf(f, "%s\"fullscreen\": \"%s\"", indent, fullscreen);
+}
+
+static void
+td_json_steps(FILE *f, const TDScenario *sc)
+{
+	unsigned int i;
+
+	fprintf(f, "\t\"steps\": [\n");
+	for (i=0; i<sc->count; i++) {
+		const TDScenarioStep *step=&sc->step[i];
+		double elapsed=(step->t_end - step->t_start)/1000000000.0;
+		fprintf(f, "\t\t{\n\t\t\t\"step\": %u,\n\t\t\t\"label\": ", i);
+		td_json_string(f, (step->label)?step->label:"");
+		fprintf(f, ",\n\t\t\t\"config\": {\n");
+		td_json_settings(f, "\t\t\t\t", &step->applied);
+		fprintf(f, "\n\t\t\t},\n");
+		fprintf(f, "\t\t\t\"completed\": %s,\n", (i < sc->cur)?"true":"false");
+		fprintf(f, "\t\t\t\"measured_frames\": %u,\n", step->measured);
+		fprintf(f, "\t\t\t\"elapsed_s\": %.6f,\n", elapsed);
+		fprintf(f, "\t\t\t\"fps\": %.3f,\n", (elapsed > 0.0)?(step->measured/elapsed):0.0);
+		td_json_stats(f, "\t\t\t", &step->stats);
+		fprintf(f, "\n\t\t}%s\n", (i+1 < sc->count)?",":"");
+	}
+	fprintf(f, "\t],\n");
+}
+
+/* the Pareto frontier of the completed auto tuning candidates */
+static void
+td_json_pareto(FILE *f, const TDScenario *sc, const TDTune *t)
+{
+	TDTuneResult r;
+	unsigned int i;
+	int first=1;
+
+	fprintf(f, "\t\"pareto\": [\n");
+	for (i=0; i<sc->cur; i++) {
+		if (!td_tune_on_frontier(t, sc->cur, i)) {
+			continue;
+		}
+		r=t->cand[i].result;
+		fprintf(f, "%s\t\t{\"step\": %u, \"label\": ", (first)?"":",\n", i);
+		td_json_string(f, (sc->step[i].label)?sc->step[i].label:"");
+		fprintf(f, ", \"latency_p99_ms\": %.6f, \"missed_per_frame\": %.6f, \"fps\": %.3f}",
+			r.latency/1000000.0, r.missed, (r.frame_time > 0.0)?(1000000000.0/r.frame_time):0.0);
+		first=0;
+	}
+	fprintf(f, "%s\t],\n", (first)?"":"\n");
+}
+
+static int
+td_bench_write_json(const TDContext *ctx)
+{
+	const TDBench *b=&ctx->bench;
+	double elapsed=(b->t_end - b->t_start)/1000000000.0;
+	uint64_t duration=b->duration_ns;
+	TDClockModel model;
+	FILE *f=stdout;
+	unsigned int n;
+	int err,i;
+
+	if (b->json && strcmp(b->json, "-")) {
+		if (!(f=fopen(b->json, "w"))) {
+			warn("failed to open '%s'", b->json);
+			return -1;
+		}
+	}
+	fprintf(f, "{\n");
+	fprintf(f, "\t\"config\": {\n");
+	td_json_settings(f, "\t\t", &b->settings);
+	fprintf(f, ",\n\t\t\"warmup_frames\": %u,\n", b->warmup);
+	/* a scenario runs for the sum of its steps */
+	if (b->scenario.count) {
+		for (duration=0, n=0; n<b->scenario.count; n++) {
+			duration += b->scenario.step[n].duration_ns;
+		}
+	}
+	fprintf(f, "\t\t\"duration_s\": %.3f\n", duration/1000000000.0);
+	fprintf(f, "\t},\n");
+	if (b->scenario.count) {
+		td_json_steps(f, &b->scenario);
+	}
+	if (b->tune.max) {
+		td_json_pareto(f, &b->scenario, &b->tune);
+	}
+	fprintf(f, "\t\"present\": {\"backend\": \"%s\", \"presented\": %u, \"missed\": %u},\n",
+		td_present_name[ctx->present.used], ctx->present.presented, ctx->present.missed);
+	if (ctx->vblank.received) {
+		fprintf(f, "\t\"vblank_thread\": {\"vblanks\": %u, \"missed\": %u},\n",
+			ctx->vblank.received, ctx->vblank.missed);
+	} else {
+		fprintf(f, "\t\"vblank_thread\": null,\n");
+	}
+	if (!td_clock_get_model(&ctx->clock, &model)) {
+		fprintf(f, "\t\"clock\": {\"drift_ppm\": %.6f, \"rms_us\": %.3f, \"samples\": %u},\n",
+			model.drift*1000000.0, model.rms/1000.0, model.samples);
+	} else {
+		fprintf(f, "\t\"clock\": null,\n");
+	}
+	if (td_refresh_locked(&ctx->refresh)) {
+		const TDRefreshEst *r=&ctx->refresh;
+		fprintf(f, "\t\"refresh\": {\"video_mode_hz\": %d, \"estimated_hz\": %.6f, \"period_ns\": %.3f, "
+			"\"last_vblank_ns\": %llu, \"jitter_ns\": %.3f, \"vblanks_per_frame\": %.3f, \"outliers\": %u, "
+			"\"mismatch\": %s, \"throttled\": %s},\n",
+			ctx->win.refresh_rate, 1000000000.0/r->period, r->period,
+			(unsigned long long)td_refresh_phase(r), sqrt(r->R), r->vblanks, r->outliers,
+			td_refresh_mismatch(r)?"true":"false",
+			td_refresh_throttled(r, ctx->swapInterval)?"true":"false");
+	} else {
+		fprintf(f, "\t\"refresh\": {\"video_mode_hz\": %d, \"estimated_hz\": null},\n",
+			ctx->win.refresh_rate);
+	}
+	fprintf(f, "\t\"contention\": {\n\t\t\"simd\": \"%s\",\n", td_simd_name());
+	td_json_hist(f, "\t\t", "frame_time_without_workers", &ctx->contention.frame_time[0], 0);
+	td_json_hist(f, "\t\t", "frame_time_with_workers", &ctx->contention.frame_time[1], 1);
+	fprintf(f, "\t},\n");
+	fprintf(f, "\t\"shared\": {\n\t\t\"produced\": %u,\n\t\t\"shown\": %u,\n",
+		ctx->shared.produced, ctx->shared.shown);
+	for (i=0; i<TDSHARED_METRIC_COUNT; i++) {
+		td_json_hist(f, "\t\t", td_shared_metric_name[i], &ctx->shared.hist[i], 0);
+	}
+	td_json_hist(f, "\t\t", "latency_without_thread", &ctx->shared.latency[0], 0);
+	td_json_hist(f, "\t\t", "latency_with_thread", &ctx->shared.latency[1], 1);
+	fprintf(f, "\t},\n");
+	if (td_program_cache.dir[0]) {
+		const TDProgramCache *pc=&td_program_cache;
+		fprintf(f, "\t\"program_cache\": {\n\t\t\"supported\": %s,\n\t\t\"hits\": %u,\n"
+			"\t\t\"misses\": %u,\n\t\t\"rejected\": %u,\n\t\t\"stored\": %u,\n"
+			"\t\t\"failed\": %u,\n\t\t\"build_ms\": %.3f\n\t},\n",
+			(pc->supported > 0)?"true":"false", pc->hits, pc->misses, pc->rejected,
+			pc->stored, pc->failed, pc->time/1000000.0);
+	} else {
+		fprintf(f, "\t\"program_cache\": null,\n");
 	}
+	fprintf(f, "\t\"fullscreen_switch\": {\n");
+	td_json_hist(f, "\t\t", "in_place", &ctx->win_switch.time[0], 0);
+	td_json_hist(f, "\t\t", "recreated", &ctx->win_switch.time[1], 1);
+	fprintf(f, "\t},\n");
+	fprintf(f, "\t\"measured_frames\": %u,\n", b->measured);
+	fprintf(f, "\t\"elapsed_s\": %.6f,\n", elapsed);
+	fprintf(f, "\t\"fps\": %.3f,\n", (elapsed > 0.0)?(b->measured/elapsed):0.0);
+	td_json_stats(f, "\t", &ctx->stats[TDSCOPE_TOTAL]);
+	fprintf(f, "\n}\n");
+	err=ferror(f);
+	if (f != stdout) {
+		err |= fclose(f);
+	} else {
+		fflush(f);
+	}
+	return (err)?-1:0;
 }
 
 /****************************************************************************
@@ -768,36 +6772,352 @@ td_ctx_reset(TDContext *ctx)
 	ctx->avg_lat=-1.0;
 	ctx->avg_fps=-1.0;
 	ctx->cur_lat=-1.0;
-	ctx->flags &= ~(TDCTX_DROP_WINDOW | TDCTX_BINDING_EXTENSIONS_LOADED | TDCTX_SWAP_INTERVAL_SET);
+	ctx->prev_swap_ret=0;
+	ctx->prev_msc=0;
+	ctx->prev_step=0;
+	td_stats_reset(&ctx->stats[TDSCOPE_INTERVAL]);
+	ctx->flags &= ~(TDCTX_DROP_WINDOW | TDCTX_BINDING_EXTENSIONS_LOADED | TDCTX_SWAP_INTERVAL_SET |
+		TDCTX_SWITCH_WINDOW);
 }
 
 static void
 td_ctx_init(TDContext *ctx)
 {
-	int i;
-
 	td_win_init(&ctx->win);
 	td_disp_pulse_init(&ctx->pulse);
 	td_disp_bars_init(&ctx->bars);
+	td_disp_load_init(&ctx->load);
+	td_disp_pipeline_init(&ctx->pipeline);
+	td_disp_draws_init(&ctx->draws);
+	td_upload_init(&ctx->upload);
+	td_shared_init(&ctx->shared);
+	td_program_cache_init(&td_program_cache, NULL);
+	ctx->win_switch.t_request=0;
+	ctx->win_switch.applied=0;
+	td_hist_reset(&ctx->win_switch.time[0]);
+	td_hist_reset(&ctx->win_switch.time[1]);
 	ctx->mode=TDDISP_BARS;
 	ctx->swapControlMode=(TDSwapControlMode)0;
 	ctx->swapInterval=1;
 	ctx->flags=TDCTX_FLAGS_DEFAULT;
 	td_ctx_reset(ctx);
 	ctx->cur_lat=-1.0;
-	for (i=0; i<TIMER_QUERY_COUNT; i++) {
-		ctx->timer_query_obj[i]=0;
-		ctx->timestamp[i]=0;
-	}
+	td_query_ring_init(&ctx->queries);
+	td_telemetry_init(&ctx->telemetry);
+	td_present_init(&ctx->present);
+	td_vblank_init(&ctx->vblank);
+	td_limiter_init(&ctx->limiter);
+	td_cap_init(&ctx->cap);
+	ctx->fps_cap=0.0;
+	td_jit_init(&ctx->jit, JIT_MARGIN_DEFAULT);
+	ctx->jit_enabled=0;
+	td_contention_init(&ctx->contention);
+	ctx->frames_in_flight=0;
+	ctx->fence_wait=TDWAIT_BLOCK;
+	td_clock_init(&ctx->clock);
+	td_stats_reset(&ctx->stats[TDSCOPE_TOTAL]);
+	ctx->stat_scopes=(1U<<TDSCOPE_COUNT)-1;
+	ctx->stat_step=NULL;
+	td_bench_init(&ctx->bench);
 	ctx->busy_wait_ns = 0;
 	ctx->sleep_ns = 0;
 }
 
+/* printed regardless of -q */
+static void
+td_usage(const char *name)
+{
+	printf("usage: %s [options]\n"
+		"  -h, --help                   show this help\n"
+		"  -q, --quiet                  suppress console output\n"
+		"  -v, --verbose <level>        set the console output level (default: %d)\n"
+		"  --mode <name|n>              display mode: none, colors, pulse, bars\n"
+		"  --swap-control <name|n>      swap control mode: EXT, SGI, MESA\n"
+		"  --present <name>             swap completion timing: auto, query, oml, intel,\n"
+		"                               xpresent\n"
+		"  --interval <n>               set swap interval n for every new window\n"
+		"  --sleep <ms>                 additional CPU sleep time per frame\n"
+		"  --busy-wait <ms>             additional CPU busy wait time per frame\n"
+		"  --flush                      glFlush every frame\n"
+		"  --finish                     glFinish every frame\n"
+		"  --frames-in-flight <n>       limit the frames queued to the GPU with fences\n"
+		"  --fence-wait <name>          how to wait for the fences: block, spin, yield\n"
+		"  --fps-cap <fps>              start frames at a fixed rate (0: off)\n"
+		"  --jit <ms>                   start frames just in time for the next vblank\n"
+		"  --gpu-iterations <n>         ALU iterations per pixel in the load pattern\n"
+		"  --gpu-memory <MiB>           memory read per frame in the load pattern\n"
+		"  --passes <n>                 post processing passes in the pipeline pattern\n"
+		"  --msaa <samples>             MSAA samples in the pipeline pattern (0: off)\n"
+		"  --scale <percent>            internal resolution of the pipeline pattern\n"
+		"  --draws <n>                  draw calls per frame in the draws pattern\n"
+		"  --draw-method <name>         how to draw them: naive, instanced, indirect\n"
+		"  --upload <MiB>               texture data uploaded per frame\n"
+		"  --upload-method <name>       teximage, orphan, pbo, persistent\n"
+		"  --shared <MiB>               render in a second, shared context on a thread\n"
+		"  --shared-fps <fps>           frame rate of that thread (default: 0, unlimited)\n"
+		"  --workers <n>                worker threads contending for the CPU\n"
+		"  --duty <percent>             how busy the workers are (default: 100)\n"
+		"  --workload <name>            worker load: spin, stream, thrash, simd\n"
+		"  --worker-cpus <list>         pin the workers to these CPUs, e.g. 2-5,7\n"
+		"  --fullscreen                 start in (windowed) fullscreen\n"
+		"  --fullscreen-mode-switch     start in fullscreen with mode switch\n"
+		"  --fullscreen-recreate        recreate the window to switch fullscreen\n"
+		"  --program-cache <dir>        where to cache linked program binaries\n"
+		"  --no-program-cache           always compile the shaders\n"
+		"  --benchmark                  run non-interactively and write a JSON summary\n"
+		"  --warmup <frames>            benchmark warmup frames (default: 60)\n"
+		"  --duration <s>               benchmark duration (default: 10), implies --benchmark\n"
+		"  --scenario <file>            run the steps of a scenario file, implies --benchmark\n"
+		"  --autotune <n>               search the latency/throughput Pareto frontier of sleep,\n"
+		"                               busy wait, frames in flight and flush/finish with\n"
+		"                               at most n candidates of --duration each\n"
+		"  --json <file>                benchmark JSON summary file (default: stdout)\n"
+		"  --telemetry <file>           write per-frame telemetry CSV to file\n"
+		"  --vblank-thread              timestamp every vblank in a helper thread\n"
+		"  --no-clock-calibration       sample the GL clock every frame instead of\n"
+		"                               calibrating it in the background\n",
+		name, INFO_LEVEL_DEFAULT);
+}
+
 static int
-td_ctx_config(int argc, char **argv)
+td_ctx_config(TDContext *ctx, int argc, char **argv)
 {
-	(void)argc;
-	(void)argv;
+	int level_set=0;
+	double d;
+	long l;
+	int i,v;
+
+	for (i=1; i<argc; i++) {
+		const char *opt=argv[i];
+		const char *arg=(i+1 < argc)?argv[i+1]:NULL;
+
+		if (!strcmp(opt, "-h") || !strcmp(opt, "--help")) {
+			td_usage(argv[0]);
+			exit(0);
+		} else if (!strcmp(opt, "-q") || !strcmp(opt, "--quiet")) {
+			info_level=-1;
+			level_set=1;
+			continue;
+		} else if (!strcmp(opt, "--flush")) {
+			ctx->flags |= TDCTX_GL_FLUSH;
+			continue;
+		} else if (!strcmp(opt, "--finish")) {
+			ctx->flags |= TDCTX_GL_FINISH;
+			continue;
+		} else if (!strcmp(opt, "--fullscreen")) {
+			ctx->win.flags &= ~(TDWIN_DECORATED | TDWIN_FULLSCREEN_MODE_SWITCH);
+			ctx->win.flags |= TDWIN_FULLSCREEN;
+			continue;
+		} else if (!strcmp(opt, "--fullscreen-mode-switch")) {
+			ctx->win.flags &= ~TDWIN_DECORATED;
+			ctx->win.flags |= TDWIN_FULLSCREEN | TDWIN_FULLSCREEN_MODE_SWITCH;
+			continue;
+		} else if (!strcmp(opt, "--fullscreen-recreate")) {
+			ctx->flags |= TDCTX_FULLSCREEN_RECREATE;
+			continue;
+		} else if (!strcmp(opt, "--no-program-cache")) {
+			td_program_cache_init(&td_program_cache, "");
+			continue;
+		} else if (!strcmp(opt, "--benchmark")) {
+			ctx->bench.active=1;
+			continue;
+		} else if (!strcmp(opt, "--vblank-thread")) {
+			ctx->vblank.enabled=1;
+			continue;
+		} else if (!strcmp(opt, "--no-clock-calibration")) {
+			ctx->clock.enabled=0;
+			continue;
+		}
+
+		/* all other options take an argument */
+		if (!arg) {
+			warn("unknown or incomplete option '%s'", opt);
+			return -1;
+		}
+		i++;
+		if (!strcmp(opt, "-v") || !strcmp(opt, "--verbose")) {
+			if (td_parse_int(arg, -1, INT_MAX, &l)) {
+				return -1;
+			}
+			info_level=(int)l;
+			level_set=1;
+		} else if (!strcmp(opt, "--mode")) {
+			if ((v=td_parse_name(arg, td_disp_name, TDDISP_MODE_COUNT)) < 0) {
+				return -1;
+			}
+			ctx->mode=(TDDisplayMode)v;
+		} else if (!strcmp(opt, "--swap-control")) {
+			if ((v=td_parse_name(arg, td_swap_control_name, TDSWAP_CONTROL_COUNT)) < 0) {
+				return -1;
+			}
+			ctx->swapControlMode=(TDSwapControlMode)v;
+		} else if (!strcmp(opt, "--present")) {
+			if ((v=td_parse_name(arg, td_present_name, TDPRESENT_COUNT)) < 0) {
+				return -1;
+			}
+			ctx->present.requested=(TDPresentMode)v;
+		} else if (!strcmp(opt, "--interval")) {
+			if (td_parse_int(arg, INT_MIN, INT_MAX, &l)) {
+				return -1;
+			}
+			ctx->swapInterval=(int)l;
+			ctx->flags |= TDCTX_SWAP_INTERVAL_APPLY;
+		} else if (!strcmp(opt, "--sleep")) {
+			if (td_parse_double(arg, &d)) {
+				return -1;
+			}
+			ctx->sleep_ns=(uint64_t)(d * 1000000.0);
+		} else if (!strcmp(opt, "--busy-wait")) {
+			if (td_parse_double(arg, &d)) {
+				return -1;
+			}
+			ctx->busy_wait_ns=(uint64_t)(d * 1000000.0);
+		} else if (!strcmp(opt, "--frames-in-flight")) {
+			if (td_parse_int(arg, 0, FRAMES_IN_FLIGHT_MAX, &l)) {
+				return -1;
+			}
+			ctx->frames_in_flight=(unsigned int)l;
+		} else if (!strcmp(opt, "--fps-cap")) {
+			if (td_parse_double(arg, &d) || d < 0.0) {
+				return -1;
+			}
+			ctx->fps_cap=d;
+		} else if (!strcmp(opt, "--gpu-iterations")) {
+			if (td_parse_int(arg, 0, GPU_LOAD_ITERATIONS_MAX, &l)) {
+				return -1;
+			}
+			ctx->load.iterations=(unsigned int)l;
+		} else if (!strcmp(opt, "--gpu-memory")) {
+			if (td_parse_int(arg, 0, GPU_LOAD_MEMORY_MAX, &l)) {
+				return -1;
+			}
+			ctx->load.memory=(unsigned int)l;
+		} else if (!strcmp(opt, "--passes")) {
+			if (td_parse_int(arg, 0, PIPELINE_PASSES_MAX, &l)) {
+				return -1;
+			}
+			ctx->pipeline.passes=(unsigned int)l;
+		} else if (!strcmp(opt, "--msaa")) {
+			if (td_parse_int(arg, 0, 32, &l)) {
+				return -1;
+			}
+			ctx->pipeline.samples=(unsigned int)l;
+		} else if (!strcmp(opt, "--scale")) {
+			if (td_parse_int(arg, 10, PIPELINE_SCALE_MAX, &l)) {
+				return -1;
+			}
+			ctx->pipeline.scale=(unsigned int)l;
+		} else if (!strcmp(opt, "--draws")) {
+			if (td_parse_int(arg, 0, DRAWS_MAX, &l)) {
+				return -1;
+			}
+			ctx->draws.count=(unsigned int)l;
+		} else if (!strcmp(opt, "--draw-method")) {
+			if ((v=td_parse_name(arg, td_draw_method_name, TDDRAW_METHOD_COUNT)) < 0) {
+				return -1;
+			}
+			ctx->draws.method=(TDDrawMethod)v;
+		} else if (!strcmp(opt, "--upload")) {
+			if (td_parse_int(arg, 0, UPLOAD_MAX, &l)) {
+				return -1;
+			}
+			ctx->upload.size=(unsigned int)l;
+		} else if (!strcmp(opt, "--upload-method")) {
+			if ((v=td_parse_name(arg, td_upload_method_name, TDUPLOAD_METHOD_COUNT)) < 0) {
+				return -1;
+			}
+			ctx->upload.method=(TDUploadMethod)v;
+		} else if (!strcmp(opt, "--shared")) {
+			if (td_parse_int(arg, 0, SHARED_MAX, &l)) {
+				return -1;
+			}
+			ctx->shared.size=(unsigned int)l;
+		} else if (!strcmp(opt, "--shared-fps")) {
+			if (td_parse_double(arg, &d) || d < 0.0) {
+				return -1;
+			}
+			ctx->shared.fps=d;
+		} else if (!strcmp(opt, "--program-cache")) {
+			if (!*arg || strlen(arg) >= PROGRAM_CACHE_PATH_MAX) {
+				return -1;
+			}
+			td_program_cache_init(&td_program_cache, arg);
+		} else if (!strcmp(opt, "--workers")) {
+			if (td_parse_int(arg, 0, CONTENTION_THREADS_MAX, &l)) {
+				return -1;
+			}
+			ctx->contention.threads=(unsigned int)l;
+		} else if (!strcmp(opt, "--duty")) {
+			if (td_parse_int(arg, 0, 100, &l)) {
+				return -1;
+			}
+			ctx->contention.duty=(unsigned int)l;
+		} else if (!strcmp(opt, "--workload")) {
+			if ((v=td_parse_name(arg, td_workload_name, TDWORKLOAD_COUNT)) < 0) {
+				return -1;
+			}
+			ctx->contention.workload=(TDWorkload)v;
+		} else if (!strcmp(opt, "--worker-cpus")) {
+			if (td_contention_parse_cpus(&ctx->contention, arg)) {
+				return -1;
+			}
+		} else if (!strcmp(opt, "--jit")) {
+			if (td_parse_double(arg, &d) || d < 0.0) {
+				return -1;
+			}
+			td_jit_init(&ctx->jit, (uint64_t)(d * 1000000.0));
+			ctx->jit_enabled=1;
+		} else if (!strcmp(opt, "--fence-wait")) {
+			if ((v=td_parse_name(arg, td_wait_name, TDWAIT_COUNT)) < 0) {
+				return -1;
+			}
+			ctx->fence_wait=(TDWaitStrategy)v;
+		} else if (!strcmp(opt, "--warmup")) {
+			if (td_parse_int(arg, 0, INT_MAX, &l)) {
+				return -1;
+			}
+			ctx->bench.warmup=(unsigned int)l;
+		} else if (!strcmp(opt, "--duration")) {
+			if (td_parse_double(arg, &d)) {
+				return -1;
+			}
+			ctx->bench.duration_ns=(uint64_t)(d * 1000000000.0);
+			ctx->bench.active=1;
+		} else if (!strcmp(opt, "--scenario")) {
+			if (td_scenario_load(&ctx->bench.scenario, arg)) {
+				return -1;
+			}
+			ctx->bench.active=1;
+		} else if (!strcmp(opt, "--autotune")) {
+			if (td_parse_int(arg, 1, 1024, &l)) {
+				return -1;
+			}
+			ctx->bench.tune.max=(unsigned int)l;
+			ctx->bench.active=1;
+		} else if (!strcmp(opt, "--json")) {
+			ctx->bench.json=arg;
+		} else if (!strcmp(opt, "--telemetry")) {
+			ctx->telemetry.filename=arg;
+		} else {
+			warn("unknown option '%s'", opt);
+			return -1;
+		}
+	}
+
+	if (ctx->bench.tune.max) {
+		if (ctx->bench.scenario.count) {
+			warn("--autotune can't be combined with --scenario");
+			return -1;
+		}
+		if (td_tune_start(&ctx->bench)) {
+			return -1;
+		}
+	}
+
+	/* keep stdout clean for the JSON summary */
+	if (ctx->bench.active && !level_set && (!ctx->bench.json || !strcmp(ctx->bench.json, "-"))) {
+		info_level=-1;
+	}
 	return 0;
 }
 
@@ -805,53 +7125,392 @@ static void
 td_ctx_destroy(TDContext *ctx)
 {
 	td_disp_bars_destroy(&ctx->bars);
+	td_disp_load_destroy(&ctx->load);
+	td_disp_pipeline_destroy(&ctx->pipeline);
+	td_disp_draws_destroy(&ctx->draws);
+	td_upload_destroy(&ctx->upload);
+	td_vblank_destroy(&ctx->vblank);
 	td_win_destroy(&ctx->win);
+	td_bench_destroy(&ctx->bench);
 }
 
+/* the shareable objects: programs, buffers and textures */
 static void
 td_ctx_gl_init(TDContext *ctx)
 {
+	td_program_cache_probe(&td_program_cache);
 	td_disp_bars_gl_init(&ctx->bars);
-	glGenQueries(TIMER_QUERY_COUNT, ctx->timer_query_obj);
+	td_disp_load_gl_init(&ctx->load);
+	td_disp_pipeline_gl_init(&ctx->pipeline);
+	td_disp_draws_gl_init(&ctx->draws);
 }
 
 static void
 td_ctx_gl_destroy(TDContext *ctx)
 {
+	td_shared_stop(&ctx->shared);
 	td_disp_bars_destroy(&ctx->bars);
-	glDeleteQueries(TIMER_QUERY_COUNT, ctx->timer_query_obj);
+	td_disp_load_destroy(&ctx->load);
+	td_disp_pipeline_destroy(&ctx->pipeline);
+	td_disp_draws_destroy(&ctx->draws);
+	td_upload_gl_destroy(&ctx->upload);
+}
+
+/* the objects which belong to the window's context: vertex arrays,
+ * framebuffers and queries are never shared between contexts */
+static void
+td_ctx_gl_attach(TDContext *ctx)
+{
+	td_disp_bars_attach(&ctx->bars);
+	td_disp_load_attach(&ctx->load);
+	td_disp_pipeline_attach(&ctx->pipeline);
+	td_disp_draws_attach(&ctx->draws);
+	td_query_ring_gl_init(&ctx->queries);
+}
+
+static void
+td_ctx_gl_detach(TDContext *ctx)
+{
+	td_disp_bars_detach(&ctx->bars);
+	td_disp_load_detach(&ctx->load);
+	td_disp_pipeline_detach(&ctx->pipeline);
+	td_disp_draws_detach(&ctx->draws);
+	td_upload_detach(&ctx->upload);
+	td_shared_detach(&ctx->shared);
+	td_query_ring_gl_destroy(&ctx->queries);
+	td_limiter_gl_destroy(&ctx->limiter);
+}
+
+/* record a value in all stat scopes the current frame belongs to */
+static void
+td_ctx_stat(TDContext *ctx, TDStatMetric metric, int64_t value)
+{
+	int i;
+
+	if (value < 0) {
+		value=0;
+	}
+	for (i=0; i<TDSCOPE_COUNT; i++) {
+		if (ctx->stat_scopes & (1U<<i)) {
+			td_hist_record(&ctx->stats[i].hist[metric], (uint64_t)value);
+		}
+	}
+	if (ctx->stat_step) {
+		td_hist_record(&ctx->stat_step->hist[metric], (uint64_t)value);
+	}
+}
+
+/* classify the frame time in all stat scopes the current frame belongs to */
+static void
+td_ctx_judder(TDContext *ctx, const TDFrameRecord *rec, uint64_t delta)
+{
+	/* the driver default interval is not known */
+	int interval=(ctx->flags & TDCTX_SWAP_INTERVAL_SET)?ctx->swapInterval:-1;
+	int i,deviation;
+
+	if (rec->msc && ctx->prev_msc && interval >= 1) {
+		/* exact vblank counts from the present timing backend */
+		deviation=(int)(rec->msc - ctx->prev_msc) - interval;
+	} else if (interval < 0 || td_judder_classify(&ctx->refresh, interval, delta, &deviation)) {
+		for (i=0; i<TDSCOPE_COUNT; i++) {
+			if (ctx->stat_scopes & (1U<<i)) {
+				ctx->stats[i].judder.unclassified++;
+			}
+		}
+		if (ctx->stat_step) {
+			ctx->stat_step->judder.unclassified++;
+		}
+		return;
+	}
+	for (i=0; i<TDSCOPE_COUNT; i++) {
+		if (ctx->stat_scopes & (1U<<i)) {
+			td_judder_record(&ctx->stats[i].judder, rec, deviation);
+		}
+	}
+	if (ctx->stat_step) {
+		td_judder_record(&ctx->stat_step->judder, rec, deviation);
+	}
+}
+
+/* called for every frame once its timer query result is known (or lost) */
+static void
+td_ctx_frame_done(TDContext *ctx, TDFrameRecord *rec)
+{
+	int i;
+
+	rec->t_vblank=0;
+	rec->vblank_count=0;
+	if (td_vblank_running(&ctx->vblank)) {
+		TDVblank vb;
+		if (!td_vblank_find(&ctx->vblank, rec->t_swap_ret, &vb)) {
+			rec->t_vblank=vb.t;
+			rec->vblank_count=vb.count;
+		}
+	}
+	if (rec->flags & TDFRAME_JIT_PENDING) {
+		if (td_jit_result(&ctx->jit, rec, td_jit_missed(rec, ctx->refresh.period),
+				ctx->refresh.period, ctx->frame)) {
+			rec->flags |= TDFRAME_JIT_MISSED;
+		}
+	}
+	ctx->stat_scopes=(1U<<TDSCOPE_COUNT)-1;
+	ctx->stat_step=NULL;
+	if (rec->flags & TDFRAME_WARMUP) {
+		ctx->stat_scopes &= ~(1U<<TDSCOPE_TOTAL);
+	} else if (rec->step < ctx->bench.scenario.count) {
+		ctx->stat_step=&ctx->bench.scenario.step[rec->step].stats;
+		ctx->stat_step->frames++;
+		if (rec->flags & TDFRAME_DROPPED) {
+			ctx->stat_step->dropped++;
+		}
+		if (rec->flags & TDFRAME_JIT_MISSED) {
+			ctx->stat_step->jit_missed++;
+		}
+		if (rec->t_present) {
+			ctx->stat_step->complete[rec->complete]++;
+		}
+	}
+	for (i=0; i<TDSCOPE_COUNT; i++) {
+		if (ctx->stat_scopes & (1U<<i)) {
+			ctx->stats[i].frames++;
+			if (rec->flags & TDFRAME_DROPPED) {
+				ctx->stats[i].dropped++;
+			}
+			if (rec->flags & TDFRAME_JIT_MISSED) {
+				ctx->stats[i].jit_missed++;
+			}
+			if (rec->t_present) {
+				ctx->stats[i].complete[rec->complete]++;
+			}
+		}
+	}
+	/* steps are applied when they start, but their frames are done a few
+	 * frames later: the first frame time of a step would span the boundary */
+	if (rec->step != ctx->prev_step) {
+		ctx->prev_swap_ret=0;
+		ctx->prev_msc=0;
+		ctx->prev_step=rec->step;
+	}
+	if (ctx->prev_swap_ret) {
+		td_ctx_stat(ctx, TDSTAT_FRAME_TIME, (int64_t)(rec->t_swap_ret - ctx->prev_swap_ret));
+		if (ctx->stat_scopes & (1U<<TDSCOPE_TOTAL)) {
+			td_hist_record(&ctx->contention.frame_time[(rec->flags & TDFRAME_CONTENDED)?1:0],
+				rec->t_swap_ret - ctx->prev_swap_ret);
+		}
+		td_ctx_judder(ctx, rec, rec->t_swap_ret - ctx->prev_swap_ret);
+	}
+	ctx->prev_swap_ret=rec->t_swap_ret;
+	ctx->prev_msc=rec->msc;
+	if (rec->t_present) {
+		td_ctx_stat(ctx, TDSTAT_DISPLAY, (int64_t)(rec->t_present - rec->t_swap));
+		if (!td_vblank_running(&ctx->vblank)) {
+			td_refresh_update(&ctx->refresh, rec->t_present);
+		}
+	} else if (rec->sbc) {
+		ctx->present.missed++;
+	}
+	if (rec->flags & TDFRAME_LIMITED) {
+		td_ctx_stat(ctx, TDSTAT_FENCE_WAIT, (int64_t)rec->fence_wait);
+	}
+	if (rec->flags & TDFRAME_CAPPED) {
+		td_ctx_stat(ctx, TDSTAT_CAP_ERROR, rec->cap_error);
+	}
+	if (rec->flags & TDFRAME_UPLOAD) {
+		td_ctx_stat(ctx, TDSTAT_UPLOAD_CPU, (int64_t)rec->upload_cpu);
+	}
+	if (rec->flags & TDFRAME_JIT) {
+		/* input to the present time if known, otherwise to the targeted
+		 * vblank, one refresh later if it was missed */
+		int64_t lat=(int64_t)(rec->jit_target - rec->t_poll);
+		if (rec->t_present) {
+			lat=(int64_t)(rec->t_present - rec->t_poll);
+		} else if (rec->flags & TDFRAME_JIT_MISSED) {
+			lat += (int64_t)ctx->refresh.period;
+		}
+		td_ctx_stat(ctx, TDSTAT_JIT, lat);
+	}
+	if (rec->t_vblank) {
+		td_ctx_stat(ctx, TDSTAT_VBLANK, (int64_t)(rec->t_swap_ret - rec->t_vblank));
+	}
+	td_ctx_stat(ctx, TDSTAT_SWAP_CALL, (int64_t)(rec->t_swap_ret - rec->t_swap));
+	td_ctx_stat(ctx, TDSTAT_CPU_RECORD, (int64_t)(rec->t_swap - rec->t_poll));
+	if (!(rec->flags & TDFRAME_DROPPED)) {
+		ctx->cur_lat = (double)rec->latency/1000000.0;
+		td_ctx_stat(ctx, TDSTAT_LATENCY, rec->latency);
+		if (ctx->stat_scopes & (1U<<TDSCOPE_TOTAL)) {
+			td_hist_record(&ctx->shared.latency[(rec->flags & TDFRAME_SHARED)?1:0],
+				(rec->latency > 0)?(uint64_t)rec->latency:0);
+		}
+		td_ctx_stat(ctx, TDSTAT_SUBMIT, (int64_t)rec->gpu[TDPROBE_FRAME_BEGIN] -
+			((int64_t)rec->t_poll + rec->gl_offset));
+		td_ctx_stat(ctx, TDSTAT_GPU_EXEC, (int64_t)rec->gpu[TDPROBE_DRAW_TIME]);
+		if (rec->flags & TDFRAME_UPLOAD) {
+			td_ctx_stat(ctx, TDSTAT_UPLOAD_GPU, (int64_t)(rec->gpu[TDPROBE_UPLOAD_END] -
+				rec->gpu[TDPROBE_UPLOAD_BEGIN]));
+		}
+		td_ctx_stat(ctx, TDSTAT_SWAP_QUEUE, (int64_t)(rec->gpu[TDPROBE_SWAP_END] -
+			rec->gpu[TDPROBE_SWAP_BEGIN]));
+	}
+	td_telemetry_push(&ctx->telemetry, rec);
+}
+
+/* process all frames whose timer query results (and present times, if
+ * used) are available; with flush set, process all pending frames, waiting
+ * for their query results but not for the present times */
+static void
+td_ctx_harvest(TDContext *ctx, int flush)
+{
+	TDQuerySlot *slot;
+
+	td_present_poll(&ctx->present, &ctx->queries);
+	while ((slot=td_query_ring_pending(&ctx->queries, 0))) {
+		if (!flush && td_present_pending(&ctx->present, &slot->rec, ctx->frame)) {
+			break;
+		}
+		if (!td_query_ring_harvest(&ctx->queries, &slot, flush)) {
+			break;
+		}
+		slot->rec.latency=(int64_t)(slot->rec.gpu[TDPROBE_SWAP_END] - slot->timestamp);
+		td_ctx_frame_done(ctx, &slot->rec);
+	}
 }
 
 static void
 td_ctx_main_loop(TDContext *ctx)
 {
 	double t_now,t_start=glfwGetTime(),t_last=t_start,t_prev=t_last;
-	double lat_ms=0.0;
+	unsigned int i;
+
 	ctx->frame=0;
 	ctx->frame_int=0;
+	ctx->jit.backoff_frame=0;
 
 	while((ctx->flags & (TDCTX_RUN | TDCTX_DROP_WINDOW)) == TDCTX_RUN) {
-		unsigned int cur_query = ctx->frame % TIMER_QUERY_COUNT;
+		TDFrameRecord *rec;
+		TDQuerySlot *slot,*lost;
+		TDClockModel model;
+		uint64_t t0,t1;
+		unsigned int work;
 		double elapsed;
 
+		if (td_vblank_running(&ctx->vblank)) {
+			td_vblank_drain(&ctx->vblank, &ctx->refresh);
+		}
+		td_ctx_harvest(ctx, 0);
+		td_ctx_tune_poll(ctx);
+		slot=td_query_ring_issue(&ctx->queries, &lost);
+		if (lost) {
+			int i;
+			lost->rec.flags |= TDFRAME_DROPPED;
+			for (i=0; i<TDPROBE_COUNT; i++) {
+				lost->rec.gpu[i]=0;
+			}
+			lost->rec.latency=-1;
+			td_ctx_frame_done(ctx, &lost->rec);
+		}
+		rec=&slot->rec;
+		rec->frame=ctx->frame;
+		rec->flags=0;
+		rec->step=0;
+		rec->cap_error=0;
+		rec->jit_target=0;
+		work=td_contention_work(&ctx->contention);
+		if (ctx->shared.active) {
+			rec->flags |= TDFRAME_SHARED;
+		}
+		if (ctx->jit_enabled && (rec->jit_target=td_jit_wait(&ctx->jit, &ctx->cap, &ctx->refresh))) {
+			rec->flags |= TDFRAME_JIT;
+			ctx->cap.deadline=0;
+		} else if (ctx->fps_cap > 0.0) {
+			rec->cap_error=td_cap_wait(&ctx->cap, ctx->fps_cap);
+			rec->flags |= TDFRAME_CAPPED;
+		} else {
+			ctx->cap.deadline=0;
+		}
+
+		rec->t_poll=get_current_time();
+		glQueryCounter(slot->query[TDPROBE_FRAME_BEGIN], GL_TIMESTAMP);
 		glfwPollEvents();
 		if (glfwWindowShouldClose(ctx->win.win)) {
 			ctx->flags &= ~ TDCTX_RUN;
 		}
+		if (ctx->flags & TDCTX_SWITCH_WINDOW) {
+			td_ctx_switch_window(ctx);
+		}
+
+		glQueryCounter(slot->query[TDPROBE_UPLOAD_BEGIN], GL_TIMESTAMP);
+		rec->upload_cpu=0;
+		if (ctx->upload.size) {
+			if (!td_upload_frame(&ctx->upload, &rec->upload_cpu)) {
+				rec->flags |= TDFRAME_UPLOAD;
+			} else {
+				rec->upload_cpu=0;
+			}
+		} else if (ctx->upload.allocated) {
+			td_upload_gl_destroy(&ctx->upload);
+		}
+		glQueryCounter(slot->query[TDPROBE_UPLOAD_END], GL_TIMESTAMP);
 
 		glViewport(0,0,ctx->win.size[0],ctx->win.size[1]);
+		glBeginQuery(GL_TIME_ELAPSED, slot->query[TDPROBE_DRAW_TIME]);
 		td_disp(ctx);
+		/* all draw calls are submitted */
+		rec->t_draw=get_current_time();
+		glEndQuery(GL_TIME_ELAPSED);
+		glQueryCounter(slot->query[TDPROBE_DRAW_END], GL_TIMESTAMP);
+		/* the thumbnail is part of the upload cost, not of the draw time */
+		if (rec->flags & TDFRAME_UPLOAD) {
+			td_upload_show(&ctx->upload, ctx->win.size);
+		}
+		td_disp_post(ctx);
 
+		glQueryCounter(slot->query[TDPROBE_SWAP_BEGIN], GL_TIMESTAMP);
+		/* directly before the swap, after flush, finish, sleep and busy wait */
+		rec->t_swap=get_current_time();
 		glfwSwapBuffers(ctx->win.win);
-		t_now=glfwGetTime();
-		if (ctx->frame >= TIMER_QUERY_COUNT) {
-			GLuint64 result;
-			glGetQueryObjectui64v(ctx->timer_query_obj[cur_query], GL_QUERY_RESULT, &result);
-			ctx->cur_lat = ((double)(result - ctx->timestamp[cur_query]))/1000000.0;
-			lat_ms += ctx->cur_lat;
+		rec->t_swap_ret=get_current_time();
+		if (ctx->win_switch.applied) {
+			td_ctx_switch_done(ctx, rec->t_swap_ret);
+		}
+		td_present_swap(&ctx->present, rec);
+		if (ctx->contention.active && td_contention_work(&ctx->contention) != work) {
+			/* the workers actually ran during the frame */
+			rec->flags |= TDFRAME_CONTENDED;
+		}
+		if (rec->flags & TDFRAME_JIT) {
+			td_jit_cost(&ctx->jit, rec);
+			if (rec->sbc || td_vblank_running(&ctx->vblank)) {
+				/* judged once the present or vblank time is known */
+				rec->flags |= TDFRAME_JIT_PENDING;
+			} else if (td_jit_result(&ctx->jit, rec, td_jit_missed(rec, ctx->refresh.period),
+					ctx->refresh.period, ctx->frame + 1)) {
+				rec->flags |= TDFRAME_JIT_MISSED;
+			}
+		}
+		if (!rec->sbc && !td_vblank_running(&ctx->vblank) &&
+			(ctx->flags & TDCTX_SWAP_INTERVAL_SET) && ctx->swapInterval > 0) {
+			/* without vblank or present times, estimate from the swap
+			 * returns, which are only tied to the vblank with vsync */
+			td_refresh_update(&ctx->refresh, rec->t_swap_ret);
+		}
+		glQueryCounter(slot->query[TDPROBE_SWAP_END], GL_TIMESTAMP);
+		t0=get_current_time();
+		if (!td_clock_get_model(&ctx->clock, &model)) {
+			slot->timestamp=td_clock_cpu_to_gl(&model, t0);
+			rec->gl_offset=(int64_t)(slot->timestamp - t0);
+		} else {
+			/* no calibration (yet), query the GL clock directly */
+			glGetInteger64v(GL_TIMESTAMP, (GLint64*)&slot->timestamp);
+			t1=get_current_time();
+			rec->gl_offset=(int64_t)slot->timestamp - (int64_t)(t0 + (t1-t0)/2);
 		}
-		glQueryCounter(ctx->timer_query_obj[cur_query], GL_TIMESTAMP);
-		glGetInteger64v(GL_TIMESTAMP, (GLint64*)&ctx->timestamp[cur_query]);
+		rec->fence_wait=0;
+		if (ctx->frames_in_flight) {
+			rec->fence_wait=td_limiter_frame(&ctx->limiter, ctx->frames_in_flight, ctx->fence_wait);
+			rec->flags |= TDFRAME_LIMITED;
+		}
+		td_ctx_bench_frame(ctx, rec);
+		t_now=glfwGetTime();
 
 		ctx->frame++;
 		ctx->frame_int++;
@@ -862,36 +7521,210 @@ td_ctx_main_loop(TDContext *ctx)
 		elapsed=t_now-t_last;
 		if (elapsed > 1.0) {
 			ctx->avg_fps=(double)ctx->frame_int/elapsed;
-			ctx->avg_lat=(double)lat_ms / (double)ctx->frame_int;
+			if (ctx->stats[TDSCOPE_INTERVAL].hist[TDSTAT_LATENCY].total) {
+				ctx->avg_lat=td_hist_mean(&ctx->stats[TDSCOPE_INTERVAL].hist[TDSTAT_LATENCY])/1000000.0;
+			}
+			td_judder_end_burst(&ctx->stats[TDSCOPE_INTERVAL].judder);
 			td_ctx_set_title(ctx);
+			td_stats_reset(&ctx->stats[TDSCOPE_INTERVAL]);
 			ctx->frame_int=0;
-			lat_ms=0.0f;
 			t_last=t_now;
 		}
 	}
+
+	/* the loop is over, so we can afford to wait for the outstanding results */
+	glFinish();
+	td_ctx_harvest(ctx, 1);
+	for (i=0; i<TDSCOPE_COUNT; i++) {
+		td_judder_end_burst(&ctx->stats[i].judder);
+	}
+	for (i=0; i<ctx->bench.scenario.count; i++) {
+		td_judder_end_burst(&ctx->bench.scenario.step[i].stats.judder);
+	}
+	ctx->prev_swap_ret=0;
+	ctx->prev_msc=0;
+}
+
+static void
+td_ctx_report(TDContext *ctx)
+{
+	const TDStats *stats=&ctx->stats[TDSCOPE_TOTAL];
+	TDClockModel model;
+	int i;
+
+	info(0,"%u frames, %u timer query results dropped", stats->frames, stats->dropped);
+	if (ctx->present.presented || ctx->present.missed) {
+		info(0,"present timing (%s): %u swaps with display timestamps, %u without, "
+			"flip/copy/suboptimal copy/skip: %u/%u/%u/%u",
+			td_present_name[ctx->present.used], ctx->present.presented, ctx->present.missed,
+			stats->complete[TDCOMPLETE_FLIP], stats->complete[TDCOMPLETE_COPY],
+			stats->complete[TDCOMPLETE_SUBOPTIMAL_COPY], stats->complete[TDCOMPLETE_SKIP]);
+	}
+	if (!td_clock_get_model(&ctx->clock, &model)) {
+		info(0,"GL clock: drift %.3fppm, residual %.3fus rms over %u samples",
+			model.drift*1000000.0, model.rms/1000.0, model.samples);
+	}
+	if (stats->hist[TDSTAT_CAP_ERROR].total) {
+		info(0,"frame rate cap: spin margin %.1fus, last oversleep %.1fus, %u deadlines missed by more than a frame",
+			ctx->cap.margin/1000.0, ctx->cap.oversleep/1000.0, ctx->cap.resets);
+	}
+	if (ctx->bench.tune.max) {
+		const TDScenario *sc=&ctx->bench.scenario;
+		TDTuneResult r;
+		info(0,"auto tuning: Pareto frontier of %u measured candidates (lat p99, missed refreshes per frame, FPS):", sc->cur);
+		for (i=0; i<(int)sc->cur; i++) {
+			if (td_tune_on_frontier(&ctx->bench.tune, sc->cur, (unsigned int)i)) {
+				r=ctx->bench.tune.cand[i].result;
+				info(0,"  %8.3fms %8.4f %9.2f  %s", r.latency/1000000.0, r.missed,
+					(r.frame_time > 0.0)?(1000000000.0/r.frame_time):0.0,
+					(sc->step[i].label)?sc->step[i].label:"");
+			}
+		}
+	}
+	if (stats->hist[TDSTAT_UPLOAD_CPU].total) {
+		info(0,"texture upload: %u MiB per frame via %s, CPU p50/p99: %.3f/%.3fms, GPU transfer p50/p99: %.3f/%.3fms",
+			ctx->upload.size, td_upload_method_name[ctx->upload.used],
+			td_hist_percentile(&stats->hist[TDSTAT_UPLOAD_CPU], 50.0)/1000000.0,
+			td_hist_percentile(&stats->hist[TDSTAT_UPLOAD_CPU], 99.0)/1000000.0,
+			td_hist_percentile(&stats->hist[TDSTAT_UPLOAD_GPU], 50.0)/1000000.0,
+			td_hist_percentile(&stats->hist[TDSTAT_UPLOAD_GPU], 99.0)/1000000.0);
+	}
+	if (td_program_cache.supported > 0) {
+		const TDProgramCache *pc=&td_program_cache;
+		info(0,"program cache: %u hits, %u misses, %u rejected, %u stored, %u failed, %.3fms building programs",
+			pc->hits, pc->misses, pc->rejected, pc->stored, pc->failed, pc->time/1000000.0);
+	}
+	if (ctx->win_switch.time[0].total || ctx->win_switch.time[1].total) {
+		char pct[2][128];
+		td_hist_format(&ctx->win_switch.time[0], pct[0], sizeof(pct[0]));
+		td_hist_format(&ctx->win_switch.time[1], pct[1], sizeof(pct[1]));
+		info(0,"fullscreen switch to first frame: %u in place: %s, %u recreated: %s",
+			(unsigned)ctx->win_switch.time[0].total, pct[0],
+			(unsigned)ctx->win_switch.time[1].total, pct[1]);
+	}
+	if (ctx->shared.latency[1].total) {
+		const TDShared *sh=&ctx->shared;
+		char pct[2][128];
+		info(0,"shared context: %u frames produced, %u shown, p50/p99 upload: %.3f/%.3fms, "
+			"submit: %.3f/%.3fms, GPU wait: %.3f/%.3fms, frame time: %.3f/%.3fms",
+			sh->produced, sh->shown,
+			td_hist_percentile(&sh->hist[TDSHARED_UPLOAD], 50.0)/1000000.0,
+			td_hist_percentile(&sh->hist[TDSHARED_UPLOAD], 99.0)/1000000.0,
+			td_hist_percentile(&sh->hist[TDSHARED_SUBMIT], 50.0)/1000000.0,
+			td_hist_percentile(&sh->hist[TDSHARED_SUBMIT], 99.0)/1000000.0,
+			td_hist_percentile(&sh->hist[TDSHARED_GPU], 50.0)/1000000.0,
+			td_hist_percentile(&sh->hist[TDSHARED_GPU], 99.0)/1000000.0,
+			td_hist_percentile(&sh->hist[TDSHARED_FRAME], 50.0)/1000000.0,
+			td_hist_percentile(&sh->hist[TDSHARED_FRAME], 99.0)/1000000.0);
+		td_hist_format(&sh->latency[0], pct[0], sizeof(pct[0]));
+		td_hist_format(&sh->latency[1], pct[1], sizeof(pct[1]));
+		info(0,"shared context: latency without the thread: %s, with the thread: %s", pct[0], pct[1]);
+	}
+	if (ctx->contention.frame_time[1].total) {
+		const TDContention *c=&ctx->contention;
+		char pct[2][128];
+		td_hist_format(&c->frame_time[0], pct[0], sizeof(pct[0]));
+		td_hist_format(&c->frame_time[1], pct[1], sizeof(pct[1]));
+		info(0,"CPU contention (%s, simd: %s): frame time without workers: %s, with workers: %s",
+			td_workload_name[c->workload], td_simd_name(), pct[0], pct[1]);
+	}
+	if (stats->hist[TDSTAT_JIT].total) {
+		info(0,"just in time: %u frames on time, %u missed their vblank, input to vblank p50/p99: %.3f/%.3fms, "
+			"margin %.3fms (configured %.3fms), frame cost %.3fms +- %.3fms",
+			(unsigned)stats->hist[TDSTAT_JIT].total - stats->jit_missed, stats->jit_missed,
+			td_hist_percentile(&stats->hist[TDSTAT_JIT], 50.0)/1000000.0,
+			td_hist_percentile(&stats->hist[TDSTAT_JIT], 99.0)/1000000.0,
+			ctx->jit.margin/1000000.0, ctx->jit.margin_min/1000000.0,
+			ctx->jit.cost/1000000.0, ctx->jit.cost_dev/1000000.0);
+	}
+	if (ctx->vblank.received) {
+		info(0,"vblank thread: %u vblanks, %u missed by the thread",
+			ctx->vblank.received, ctx->vblank.missed);
+	}
+	if (td_refresh_locked(&ctx->refresh)) {
+		const TDRefreshEst *r=&ctx->refresh;
+		info(0,"refresh: %.4fHz (period %.3fus, jitter %.3fus, %u outliers), video mode: %dHz%s%s",
+			1000000000.0/r->period, r->period/1000.0, sqrt(r->R)/1000.0, r->outliers,
+			ctx->win.refresh_rate,
+			td_refresh_mismatch(r)?", MISMATCH":"",
+			td_refresh_throttled(r, ctx->swapInterval)?", THROTTLED":"");
+	} else {
+		info(0,"refresh: no stable estimate, video mode: %dHz", ctx->win.refresh_rate);
+	}
+	if (stats->judder.on_time + stats->judder.early + td_judder_late(&stats->judder)) {
+		const TDJudder *j=&stats->judder;
+		info(0,"vblank: %u on time, late by 1/2/3/4+: %u/%u/%u/%u (%u refreshes missed), %u early, "
+			"%u bursts (longest %u frames), longest on-time run %u frames",
+			j->on_time, j->late[0], j->late[1], j->late[2], j->late[3], j->missed, j->early,
+			j->bursts, j->longest_burst, j->longest_run);
+		for (i=0; i<JUDDER_WORST && j->worst[i].frames; i++) {
+			info(0,"  burst at frame %u (t=%.6fs): %u frames, %u refreshes off",
+				j->worst[i].frame, j->worst[i].t_start/1000000000.0,
+				j->worst[i].frames, j->worst[i].refreshes);
+		}
+	}
+	for (i=0; i<TDSTAT_COUNT; i++) {
+		const TDHistogram *h=&stats->hist[i];
+		char pct[128];
+		td_hist_format(h, pct, sizeof(pct));
+		info(0,"%6s: n=%llu, min=%.3fms, mean=%.3fms, p50/p90/p99/p99.9/max=%s",
+			td_stat_name[i], (unsigned long long)h->total, h->min/1000000.0,
+			td_hist_mean(h)/1000000.0, pct);
+	}
 }
 
 static void
 td_ctx_run(TDContext *ctx)
 {
+	td_win_create_share(&ctx->win);
 	while(ctx->flags & TDCTX_RUN) {
 		if (!ctx->win.win) {
 			if (td_win_create(&ctx->win)) {
 				error(3,"failed to create GL window");
 				break;
 			}
+			if (ctx->win_switch.t_request) {
+				ctx->win_switch.recreate=1;
+				ctx->win_switch.applied=1;
+			}
+			td_clock_start(&ctx->clock);
 		}
 		td_ctx_reset(ctx);
+		td_refresh_init(&ctx->refresh, ctx->win.refresh_rate);
 		td_ctx_set_title(ctx);
 		glfwSetWindowUserPointer(ctx->win.win, ctx);
 		glfwSetKeyCallback(ctx->win.win, td_ctx_keyhandler);
 		glfwSetFramebufferSizeCallback(ctx->win.win, td_ctx_resize);
 		glfwSetWindowPosCallback(ctx->win.win, td_ctx_reposition);
-		td_ctx_gl_init(ctx);
+		if (!(ctx->flags & TDCTX_GL_OBJECTS)) {
+			td_ctx_gl_init(ctx);
+			ctx->flags |= TDCTX_GL_OBJECTS;
+		}
+		td_ctx_gl_attach(ctx);
+		td_shared_update(&ctx->shared, &ctx->win);
+		if (!td_ctx_load_binding_extensions(ctx)) {
+			td_present_start(&ctx->present, ctx->win.win);
+			td_vblank_start(&ctx->vblank, ctx->win.win);
+		}
+		if (ctx->flags & TDCTX_SWAP_INTERVAL_APPLY) {
+			td_ctx_set_swap_interval(ctx);
+		}
 		td_ctx_main_loop(ctx);
-		td_ctx_gl_destroy(ctx);
+		td_vblank_stop(&ctx->vblank);
+		td_present_stop(&ctx->present);
+		td_ctx_gl_detach(ctx);
+		if (!ctx->win.share) {
+			td_ctx_gl_destroy(ctx);
+			ctx->flags &= ~TDCTX_GL_OBJECTS;
+		}
 		td_win_destroy(&ctx->win);
 	}
+	if (ctx->win.share) {
+		glfwMakeContextCurrent(ctx->win.share);
+		td_ctx_gl_destroy(ctx);
+		glfwMakeContextCurrent(NULL);
+		td_win_destroy_share(&ctx->win);
+	}
 }
 
 /****************************************************************************
@@ -900,18 +7733,44 @@ td_ctx_run(TDContext *ctx)
 
 int main(int argc, char **argv)
 {
-	TDContext ctx;
+	/* static because of the histograms, it is quite large */
+	static TDContext ctx;
 
+#if defined(LINUX)
+	/* the helper threads use GLX on GLFW's display connection while the
+	 * main thread keeps using it, GLFW doesn't make Xlib thread safe */
+	if (!XInitThreads()) {
+		warn("XInitThreads failed");
+	}
+#endif
 	if (!glfwInit()) {
 		error(1,"GFLW initialization failed");
 	}
 
 	td_ctx_init(&ctx);
-	if (td_ctx_config(argc, argv)) {
+	if (td_ctx_config(&ctx, argc, argv)) {
 		error(2,"invalid parameters");
 	}
+	if (td_telemetry_start(&ctx.telemetry)) {
+		error(4,"failed to start telemetry");
+	}
+	if (ctx.bench.active) {
+		td_bench_start(&ctx);
+	}
+	td_contention_update(&ctx.contention);
 
 	td_ctx_run(&ctx);
+	if (ctx.bench.tune.max) {
+		/* the run may have ended before the last candidate was scored */
+		td_tune_score(&ctx.bench);
+	}
+	td_contention_stop(&ctx.contention);
+	td_clock_stop(&ctx.clock);
+	td_telemetry_stop(&ctx.telemetry);
+	td_ctx_report(&ctx);
+	if (ctx.bench.active && td_bench_write_json(&ctx)) {
+		error(5,"failed to write benchmark results");
+	}
 
 	td_ctx_destroy(&ctx);
 	glfwTerminate();